@@ -0,0 +1,782 @@
+//
+//  Micro benchmarks for the pth primitives.
+//  usage: benchpth [benchmark ...]   (runs all of them when none is named)
+//
+
+
+#include "pth.hxx"
+#include "pth_combine.hxx"
+#include "pth_cache.hxx"
+#include "pth_stack.hxx"
+#include "pth_pool.hxx"
+#include "pth_future.hxx"
+#include "pth_parallel.hxx"
+#include "pth_graph.hxx"
+#include "pth_group.hxx"
+#include "pth_coro.hxx"
+#include "pth_channel.hxx"
+#include "pth_sender.hxx"
+#include <pthread.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <queue>
+#include <algorithm>
+#include <numeric>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <cmath>
+#include <string>
+
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+int hardware_threads() {
+    long n = ::sysconf( _SC_NPROCESSORS_ONLN );
+    return n > 0 ? int(n) : 1;
+}
+
+double elapsed_ns( bench_clock::time_point start ) {
+    return std::chrono::duration<double, std::nano>( bench_clock::now() - start ).count();
+}
+
+void report( const char* bench, const char* variant, double total_ns, long ops ) {
+    std::cout << std::left << std::setw(14) << bench << std::setw(28) << variant 
+              << std::right << std::setw(12) << std::fixed << std::setprecision(1) 
+              << total_ns / 1e6 << " ms" << std::setw(12) << total_ns / ops << " ns/op" << std::endl;
+}
+
+
+// Lock handoff under oversubscription: 4 threads per cpu hammering one 
+// short critical section
+
+template<class Lock>
+struct contention_arg {
+    Lock* lock;
+    volatile long* counter;
+    long iters;
+};
+
+template<class Lock>
+void* hammer( void* p ) {
+    auto* arg = static_cast<contention_arg<Lock>*>(p);
+    for ( long i = 0; i < arg->iters; i++ ) {
+        arg->lock->lock();
+        *arg->counter = *arg->counter + 1;
+        arg->lock->unlock();
+    }
+    return nullptr;
+}
+
+template<class Lock, class... Ctor>
+void contention( const char* variant, int num_threads, long iters, Ctor... ctor ) {
+    Lock lock( ctor... );
+    volatile long counter = 0;
+    contention_arg<Lock> arg{ &lock, &counter, iters };
+
+    auto start = bench_clock::now();
+    {
+        std::vector<pth::thread> threads;
+        for ( auto i{0}; i < num_threads; i++ ) {
+            threads.push_back( pth::thread( hammer<Lock>, &arg ) );
+        }
+    }
+    report( "contention", variant, elapsed_ns( start ), num_threads * iters );
+    if ( counter != num_threads * iters ) std::cerr << "  lost updates: " << counter << std::endl;
+}
+
+void bench_locks() {
+    const int num_threads = 4 * hardware_threads();
+    const long iters = 500000;
+
+    contention<pth::spinlock>( "pth::spinlock", num_threads, iters, PTHREAD_PROCESS_PRIVATE );
+    contention<pth::ttas_spinlock<>>( "pth::ttas_spinlock", num_threads, iters );
+    contention<pth::hybrid_mutex>( "pth::hybrid_mutex", num_threads, iters );
+    contention<pth::mutex>( "pth::mutex", num_threads, iters );
+    contention<pth::cohort_lock<>>( "pth::cohort_lock", num_threads, iters );
+}
+
+
+// Hot sequential structure: a priority queue shared by all threads, every 
+// thread alternating push and pop
+
+struct pq_arg {
+    void* shared;
+    long iters;
+};
+
+void* pq_locked( void* p ) {
+    auto* arg = static_cast<pq_arg*>(p);
+    auto* shared = static_cast<std::pair<pth::mutex, std::priority_queue<long>>*>(arg->shared);
+    for ( long i = 0; i < arg->iters; i++ ) {
+        shared->first.lock();
+        if ( i & 1 ) shared->second.pop();
+        else shared->second.push( i * 7919 % 1000003 );
+        shared->first.unlock();
+    }
+    return nullptr;
+}
+
+void* pq_combined( void* p ) {
+    auto* arg = static_cast<pq_arg*>(p);
+    auto* shared = static_cast<pth::flat_combiner<std::priority_queue<long>>*>(arg->shared);
+    for ( long i = 0; i < arg->iters; i++ ) {
+        if ( i & 1 ) shared->apply( []( auto& pq ) { pq.pop(); } );
+        else shared->apply( [i]( auto& pq ) { pq.push( i * 7919 % 1000003 ); } );
+    }
+    return nullptr;
+}
+
+using delegated_pq = pth::delegated<std::priority_queue<long>>;
+
+void* pq_delegated( void* p ) {
+    auto* arg = static_cast<pq_arg*>(p);
+    auto client = static_cast<delegated_pq*>(arg->shared)->connect();
+    for ( long i = 0; i < arg->iters; i++ ) {
+        if ( i & 1 ) client.call( []( auto& pq ) { pq.pop(); } );
+        else client.call( [i]( auto& pq ) { pq.push( i * 7919 % 1000003 ); } );
+    }
+    return nullptr;
+}
+
+void* pq_delegated_async( void* p ) {
+    auto* arg = static_cast<pq_arg*>(p);
+    auto client = static_cast<delegated_pq*>(arg->shared)->connect();
+    for ( long i = 0; i < arg->iters; i += 2 ) {
+        auto push = client.post( [i]( auto& pq ) { pq.push( i * 7919 % 1000003 ); } );
+        auto pop = client.post( []( auto& pq ) { pq.pop(); } );
+        pop.wait();
+    }
+    return nullptr;
+}
+
+void sequential_structure( const char* variant, void* (*worker)(void*), void* shared, 
+                           int num_threads, long iters, const char* bench = "combining" ) {
+    pq_arg arg{ shared, iters };
+    auto start = bench_clock::now();
+    {
+        std::vector<pth::thread> threads;
+        for ( auto i{0}; i < num_threads; i++ ) {
+            threads.push_back( pth::thread( worker, &arg ) );
+        }
+    }
+    report( bench, variant, elapsed_ns( start ), num_threads * iters );
+}
+
+void bench_combining() {
+    const int num_threads = hardware_threads();
+    const long iters = 200000;
+
+    std::pair<pth::mutex, std::priority_queue<long>> locked;
+    sequential_structure( "pth::mutex", pq_locked, &locked, num_threads, iters );
+
+    pth::flat_combiner<std::priority_queue<long>> combined;
+    sequential_structure( "pth::flat_combiner", pq_combined, &combined, num_threads, iters );
+}
+
+void bench_delegation() {
+    const int num_threads = hardware_threads();
+    const long iters = 50000;
+
+    std::pair<pth::mutex, std::priority_queue<long>> locked;
+    sequential_structure( "pth::mutex", pq_locked, &locked, num_threads, iters, "delegation" );
+
+    {
+        delegated_pq server( num_threads - 1 );
+        sequential_structure( "pth::delegated call", pq_delegated, &server, num_threads, iters, "delegation" );
+    }
+    {
+        delegated_pq server( num_threads - 1 );
+        sequential_structure( "pth::delegated post", pq_delegated_async, &server, num_threads, iters, "delegation" );
+    }
+}
+
+
+// Spawn latency: the 50 thread create / join loop of playwpth, with fresh 
+// threads and with threads from a pth::thread_cache
+
+void* noop( void* ) {
+    return nullptr;
+}
+
+void bench_spawn() {
+    const int num_threads = 50;
+    const int rounds = 200;
+
+    ::pthread_attr_t th_attr;
+    ::pthread_attr_init( &th_attr );
+    ::pthread_attr_setdetachstate( &th_attr, PTHREAD_CREATE_JOINABLE );
+
+    double spawn_ns = 0;
+    auto start = bench_clock::now();
+    for ( auto r{0}; r < rounds; r++ ) {
+        std::vector<pth::thread> threads;
+        auto spawn_start = bench_clock::now();
+        for ( auto i{0}; i < num_threads; i++ ) {
+            threads.push_back( pth::thread( th_attr, noop ) );
+        }
+        spawn_ns += elapsed_ns( spawn_start );
+    }
+    report( "spawn", "pth::thread round", elapsed_ns( start ), rounds * num_threads );
+    report( "spawn", "pth::thread create", spawn_ns, rounds * num_threads );
+
+    pth::stack_pool stacks( 64 * 1024, num_threads, pth::stack_pool::populate );
+    spawn_ns = 0;
+    start = bench_clock::now();
+    for ( auto r{0}; r < rounds; r++ ) {
+        std::vector<pth::pooled_thread> threads;
+        auto spawn_start = bench_clock::now();
+        for ( auto i{0}; i < num_threads; i++ ) {
+            threads.push_back( pth::pooled_thread( stacks, th_attr, noop ) );
+        }
+        spawn_ns += elapsed_ns( spawn_start );
+    }
+    report( "spawn", "pth::pooled_thread round", elapsed_ns( start ), rounds * num_threads );
+    report( "spawn", "pth::pooled_thread create", spawn_ns, rounds * num_threads );
+
+    pth::thread_cache cache;
+    spawn_ns = 0;
+    start = bench_clock::now();
+    for ( auto r{0}; r < rounds; r++ ) {
+        std::vector<pth::cached_thread> threads;
+        auto spawn_start = bench_clock::now();
+        for ( auto i{0}; i < num_threads; i++ ) {
+            threads.push_back( cache.spawn( th_attr, noop ) );
+        }
+        spawn_ns += elapsed_ns( spawn_start );
+    }
+    report( "spawn", "pth::thread_cache round", elapsed_ns( start ), rounds * num_threads );
+    report( "spawn", "pth::thread_cache spawn", spawn_ns, rounds * num_threads );
+
+    ::pthread_attr_destroy( &th_attr );
+}
+
+
+// Task submission: pth::fixed_pool against pools of std::function and 
+// pth::task in a locked deque, with captures too large for std::function's 
+// inline buffer. Timed from the first submit until the pool has drained.
+
+template<class Task>
+class locked_queue_pool {
+public:
+    explicit locked_queue_pool( int workers ) {
+        for ( auto i{0}; i < workers; i++ ) _workers.push_back( pth::thread( work, this ) );
+    }
+
+    ~locked_queue_pool() {
+        _mtx.lock();
+        _stop = true;
+        _mtx.unlock();
+        _cv.broadcast();
+        _workers.clear();
+    }
+
+    void submit( Task task ) {
+        _mtx.lock();
+        _tasks.push_back( std::move( task ) );
+        _mtx.unlock();
+        _cv.signal();
+    }
+
+private:
+    static void* work( void* self ) {
+        auto& pool = *static_cast<locked_queue_pool*>(self);
+        for ( ;; ) {
+            pool._mtx.lock();
+            while ( pool._tasks.empty() && !pool._stop ) pool._cv.wait( pool._mtx );
+            if ( pool._tasks.empty() ) {
+                pool._mtx.unlock();
+                return nullptr;
+            }
+            auto task = std::move( pool._tasks.front() );
+            pool._tasks.pop_front();
+            pool._mtx.unlock();
+            task();
+        }
+    }
+
+    pth::mutex _mtx;
+    pth::cond_var _cv;
+    std::deque<Task> _tasks;
+    bool _stop = false;
+    std::vector<pth::thread> _workers;
+};
+
+void bench_pool() {
+    const int num_threads = hardware_threads();
+    const long tasks = 500000;
+    std::atomic<long> sum{ 0 };
+    const long a = 1, b = 2, c = 3, d = 4;
+
+    {
+        auto pool = std::make_unique<locked_queue_pool<std::function<void()>>>( num_threads );
+        auto start = bench_clock::now();
+        for ( long i = 0; i < tasks; i++ ) {
+            pool->submit( [&sum, a, b, c, d] { sum.fetch_add( a + b + c + d, std::memory_order_relaxed ); } );
+        }
+        pool.reset();
+        report( "pool", "std::function queue", elapsed_ns( start ), tasks );
+    }
+    {
+        auto pool = std::make_unique<locked_queue_pool<pth::task>>( num_threads );
+        auto start = bench_clock::now();
+        for ( long i = 0; i < tasks; i++ ) {
+            pool->submit( [&sum, a, b, c, d] { sum.fetch_add( a + b + c + d, std::memory_order_relaxed ); } );
+        }
+        pool.reset();
+        report( "pool", "pth::task queue", elapsed_ns( start ), tasks );
+    }
+    {
+        auto pool = std::make_unique<pth::fixed_pool>( num_threads );
+        auto start = bench_clock::now();
+        for ( long i = 0; i < tasks; i++ ) {
+            pool->submit( [&sum, a, b, c, d] { sum.fetch_add( a + b + c + d, std::memory_order_relaxed ); } );
+        }
+        pool.reset();
+        report( "pool", "pth::fixed_pool", elapsed_ns( start ), tasks );
+    }
+    {
+        pth::fixed_pool pool( num_threads );
+        const long futures = tasks / 10;
+        auto start = bench_clock::now();
+        for ( long i = 0; i < futures; i++ ) {
+            pth::async( pool, [a, b] { return a + b; } ).get();
+        }
+        report( "pool", "pth::async( fixed_pool ).get", elapsed_ns( start ), futures );
+    }
+}
+
+
+// Loops on a pth::fixed_pool, each repeated over the same data so static 
+// blocks can stay in their worker's cache: a memory bound triad over 
+// 3 x 32 MB and a compute bound sum, sequential and with each partition
+
+template<class Loop>
+void repeated( const char* variant, long n, int reps, Loop&& loop ) {
+    auto start = bench_clock::now();
+    for ( auto r{0}; r < reps; r++ ) loop();
+    report( "parallel", variant, elapsed_ns( start ), n * reps );
+}
+
+void bench_parallel() {
+    pth::fixed_pool pool( hardware_threads() );
+    const long n = 4 * 1024 * 1024;
+    const int reps = 20;
+
+    std::vector<double> a( n, 0.0 ), b( n, 1.0 ), c( n, 2.0 );
+    auto triad = [&]( long i ) { a[i] = b[i] + 3.0 * c[i]; };
+
+    const std::pair<const char*, pth::partition> partitions[] = {
+        { "static", pth::partition::static_blocks() },
+        { "dynamic(16384)", pth::partition::dynamic( 16384 ) },
+        { "guided(4096)", pth::partition::guided( 4096 ) },
+    };
+
+    repeated( "triad sequential", n, reps, [&] { for ( long i = 0; i < n; i++ ) triad( i ); } );
+    for ( const auto& [name, part] : partitions ) {
+        const std::string variant = std::string( "triad " ) + name;
+        repeated( variant.c_str(), n, reps, [&] { pth::parallel_for( pool, 0L, n, triad, part ); } );
+    }
+
+    const long m = n / 8;
+    auto term = []( long i ) { return std::sqrt( double(i) ) * std::sin( double(i) ); };
+    auto plus = []( double x, double y ) { return x + y; };
+    volatile double sink = 0;
+
+    repeated( "sum sequential", m, reps, [&] { double s = 0; for ( long i = 0; i < m; i++ ) s += term( i ); sink = s; } );
+    for ( const auto& [name, part] : partitions ) {
+        const std::string variant = std::string( "sum " ) + name;
+        repeated( variant.c_str(), m, reps, [&] { sink = pth::parallel_reduce( pool, 0L, m, 0.0, term, plus, part ); } );
+    }
+    repeated( "sum dynamic deterministic", m, reps, [&] { 
+        sink = pth::parallel_reduce( pool, 0L, m, 0.0, term, plus, pth::partition::dynamic( 16384 ), 
+                                     pth::reduce_order::deterministic ); 
+    } );
+}
+
+
+// parallel_sort and prefix scans on 10M 64 bit keys against std::sort and 
+// std::inclusive_scan, on pools from 1 worker up to one per cpu
+
+void bench_sort() {
+    const long n = 10 * 1000 * 1000;
+    std::vector<std::uint64_t> keys( n );
+    std::uint64_t x = 88172645463325252ULL;
+    for ( auto& k : keys ) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        k = x;
+    }
+    std::vector<std::uint64_t> sorted = keys;
+    std::vector<std::uint64_t> scanned( n );
+    std::vector<std::uint64_t> work( n );
+
+    auto start = bench_clock::now();
+    std::sort( sorted.begin(), sorted.end() );
+    report( "sort", "std::sort", elapsed_ns( start ), n );
+
+    start = bench_clock::now();
+    std::inclusive_scan( keys.begin(), keys.end(), scanned.begin() );
+    report( "sort", "std::inclusive_scan", elapsed_ns( start ), n );
+
+    std::vector<int> workers;
+    for ( int w = 1; w < hardware_threads(); w *= 2 ) workers.push_back( w );
+    workers.push_back( hardware_threads() );
+
+    for ( int w : workers ) {
+        pth::fixed_pool pool( w );
+        char variant[64];
+
+        work = keys;
+        start = bench_clock::now();
+        pth::parallel_sort( pool, work.begin(), work.end() );
+        std::snprintf( variant, sizeof(variant), "parallel_sort x%d", w );
+        report( "sort", variant, elapsed_ns( start ), n );
+        if ( !std::is_sorted( work.begin(), work.end() ) || work != sorted ) {
+            std::cout << "sort: wrong parallel_sort result with " << w << " workers" << std::endl;
+        }
+
+        start = bench_clock::now();
+        pth::parallel_inclusive_scan( pool, keys.begin(), keys.end(), work.begin() );
+        std::snprintf( variant, sizeof(variant), "parallel_inclusive_scan x%d", w );
+        report( "sort", variant, elapsed_ns( start ), n );
+        if ( work != scanned ) std::cout << "sort: wrong parallel_inclusive_scan result with " << w << " workers" << std::endl;
+    }
+}
+
+
+// Reruns of a task_graph: a chain, where every node continues on the 
+// thread of its predecessor, and layers of 4 nodes per cpu, each node 
+// waiting for two of the layer before
+
+void bench_graph() {
+    pth::fixed_pool pool( hardware_threads() );
+    const int reps = 200;
+    std::atomic<long> sum{ 0 };
+    auto work = [&sum] { sum.fetch_add( 1, std::memory_order_relaxed ); };
+
+    {
+        pth::task_graph chain;
+        const long n = 1000;
+        for ( long i = 0; i < n; i++ ) {
+            const auto node = chain.emplace( work );
+            if ( i > 0 ) chain.precede( node - 1, node );
+        }
+        auto start = bench_clock::now();
+        for ( auto r{0}; r < reps; r++ ) chain.run( pool );
+        report( "graph", "chain of 1000", elapsed_ns( start ), n * reps );
+    }
+    {
+        pth::task_graph layers;
+        const long width = 4L * hardware_threads(), depth = 64;
+        for ( long l = 0; l < depth; l++ ) {
+            for ( long i = 0; i < width; i++ ) {
+                const auto node = layers.emplace( work );
+                if ( l > 0 ) {
+                    layers.precede( node - width, node );
+                    layers.precede( node - width + ( i + 1 ) % width - i, node );
+                }
+            }
+        }
+        auto start = bench_clock::now();
+        for ( auto r{0}; r < reps; r++ ) layers.run( pool );
+        report( "graph", "64 layers", elapsed_ns( start ), width * depth * reps );
+    }
+}
+
+
+// Recursive fork-join: fib( 32 ) with a task_group per level down to a 
+// cutoff, joined tasks helping with the pool's queue
+
+long fib( long n ) { return n < 2 ? n : fib( n - 1 ) + fib( n - 2 ); }
+
+long group_fib( pth::fixed_pool& pool, long n, long cutoff ) {
+    if ( n < cutoff ) return fib( n );
+    long a = 0;
+    pth::task_group group( pool );
+    group.run( [&pool, &a, n, cutoff] { a = group_fib( pool, n - 1, cutoff ); } );
+    const long b = group_fib( pool, n - 2, cutoff );
+    group.wait();
+    return a + b;
+}
+
+void bench_group() {
+    volatile long n = 32;
+    const int reps = 10;
+
+    long expected = 0;
+    auto start = bench_clock::now();
+    for ( auto r{0}; r < reps; r++ ) expected += fib( n );
+    report( "group", "fib(32) sequential", elapsed_ns( start ), reps );
+
+    pth::fixed_pool pool( hardware_threads() );
+    for ( long cutoff : { 20L, 12L } ) {
+        char variant[64];
+        long sum = 0;
+        start = bench_clock::now();
+        for ( auto r{0}; r < reps; r++ ) sum += group_fib( pool, n, cutoff );
+        std::snprintf( variant, sizeof(variant), "fib(32) cutoff %ld", cutoff );
+        report( "group", variant, elapsed_ns( start ), reps );
+        if ( sum != expected ) std::cout << "group: wrong result with cutoff " << cutoff << std::endl;
+    }
+}
+
+
+// Coroutines on a pth::coro_scheduler: spawn() and get() of one that 
+// returns right away, a million yields spread over 4 coroutines per cpu, 
+// 1000 coroutines sleeping 1 ms at the same time, and the same coroutines 
+// taking turns on an async_mutex or handing values over through an 
+// async_condition
+
+pth::coro_task<long> coro_value( long v ) { co_return v; }
+
+pth::coro_task<long> coro_yields( pth::coro_scheduler& sched, long n ) {
+    long resumed = 0;
+    for ( long i = 0; i < n; i++ ) {
+        co_await sched.yield();
+        resumed++;
+    }
+    co_return resumed;
+}
+
+pth::coro_task<void> coro_sleep( pth::coro_scheduler& sched ) {
+    co_await sched.sleep_for( std::chrono::milliseconds( 1 ) );
+}
+
+pth::coro_task<void> coro_locked( pth::async_mutex& mutex, long& counter, long n ) {
+    for ( long i = 0; i < n; i++ ) {
+        auto guard = co_await mutex.scoped_lock();
+        counter++;
+    }
+}
+
+struct coro_queue {
+    pth::async_mutex mutex;
+    pth::async_condition ready;
+    std::deque<long> values;
+    long producers;
+};
+
+pth::coro_task<void> coro_produce( coro_queue& q, long n ) {
+    for ( long i = 0; i < n; i++ ) {
+        auto guard = co_await q.mutex.scoped_lock();
+        q.values.push_back( i );
+        q.ready.notify_one();
+    }
+    auto guard = co_await q.mutex.scoped_lock();
+    if ( --q.producers == 0 ) q.ready.notify_all();
+}
+
+pth::coro_task<long> coro_consume( coro_queue& q ) {
+    long sum = 0;
+    for ( ;; ) {
+        auto guard = co_await q.mutex.scoped_lock();
+        while ( q.values.empty() && q.producers > 0 ) co_await q.ready.wait( q.mutex );
+        if ( q.values.empty() ) co_return sum;
+        sum += q.values.front();
+        q.values.pop_front();
+    }
+}
+
+void bench_coro() {
+    pth::coro_scheduler sched( hardware_threads() );
+
+    {
+        const long n = 100000;
+        long sum = 0;
+        auto start = bench_clock::now();
+        for ( long i = 0; i < n; i++ ) sum += sched.spawn( coro_value( i ) ).get();
+        report( "coro", "spawn / get", elapsed_ns( start ), n );
+        if ( sum != n * ( n - 1 ) / 2 ) std::cout << "coro: wrong spawn / get sum" << std::endl;
+    }
+    {
+        const long coros = 4L * hardware_threads(), each = 1000000 / coros;
+        std::vector<pth::future<long>> done;
+        long resumed = 0;
+        auto start = bench_clock::now();
+        for ( long c = 0; c < coros; c++ ) done.push_back( sched.spawn( coro_yields( sched, each ) ) );
+        for ( auto& f : done ) resumed += f.get();
+        report( "coro", "yield", elapsed_ns( start ), coros * each );
+        if ( resumed != coros * each ) std::cout << "coro: wrong number of yields" << std::endl;
+    }
+    {
+        const long coros = 1000;
+        std::vector<pth::future<void>> done;
+        auto start = bench_clock::now();
+        for ( long c = 0; c < coros; c++ ) done.push_back( sched.spawn( coro_sleep( sched ) ) );
+        for ( auto& f : done ) f.get();
+        report( "coro", "1000 x sleep_for( 1 ms )", elapsed_ns( start ), coros );
+    }
+    {
+        const long coros = 4L * hardware_threads(), each = 1000000 / coros;
+        pth::async_mutex mutex( sched );
+        long counter = 0;
+        std::vector<pth::future<void>> done;
+        auto start = bench_clock::now();
+        for ( long c = 0; c < coros; c++ ) done.push_back( sched.spawn( coro_locked( mutex, counter, each ) ) );
+        for ( auto& f : done ) f.get();
+        report( "coro", "async_mutex", elapsed_ns( start ), coros * each );
+        if ( counter != coros * each ) std::cout << "coro: wrong async_mutex count" << std::endl;
+    }
+    {
+        const long pairs = 2L * hardware_threads(), each = 500000 / pairs;
+        coro_queue q{ pth::async_mutex( sched ), {}, {}, pairs };
+        std::vector<pth::future<void>> produced;
+        std::vector<pth::future<long>> consumed;
+        auto start = bench_clock::now();
+        for ( long p = 0; p < pairs; p++ ) {
+            consumed.push_back( sched.spawn( coro_consume( q ) ) );
+            produced.push_back( sched.spawn( coro_produce( q, each ) ) );
+        }
+        long sum = 0;
+        for ( auto& f : produced ) f.get();
+        for ( auto& f : consumed ) sum += f.get();
+        report( "coro", "async_condition handoff", elapsed_ns( start ), pairs * each );
+        if ( sum != pairs * ( each * ( each - 1 ) / 2 ) ) std::cout << "coro: wrong async_condition sum" << std::endl;
+    }
+}
+
+
+// One producer and one consumer thread passing longs through an unbounded, 
+// a bounded and a rendezvous pth::channel, then one consumer selecting 
+// between the channels of two producers
+
+struct channel_arg {
+    pth::channel<long> ch;
+    long n;
+};
+
+// Stops early when the channel is closed
+void* channel_produce( void* p ) {
+    auto& arg = *static_cast<channel_arg*>(p);
+    for ( long i = 0; i < arg.n && arg.ch.send( i ); i++ ) { }
+    return nullptr;
+}
+
+void channel_pass( const char* variant, std::size_t capacity, long n ) {
+    channel_arg arg{ pth::channel<long>( capacity ), n };
+    pth::thread producer( channel_produce, &arg );
+    auto start = bench_clock::now();
+    for ( long i = 0; i < n; i++ ) arg.ch.receive();
+    report( "channel", variant, elapsed_ns( start ), n );
+}
+
+void bench_channel() {
+    const long n = 1000000;
+    channel_pass( "unbounded", pth::channel<long>::unbounded, n );
+    channel_pass( "bounded(64)", 64, n );
+    channel_pass( "rendezvous", pth::channel<long>::rendezvous, n / 10 );
+
+    channel_arg a{ pth::channel<long>( 64 ), n }, b{ pth::channel<long>( 64 ), n };
+    pth::thread pa( channel_produce, &a ), pb( channel_produce, &b );
+    long sum = 0;
+    auto start = bench_clock::now();
+    for ( long i = 0; i < n; i++ ) {
+        pth::select( pth::on_receive( a.ch, [&]( std::optional<long> v ) { sum += *v; } ),
+                     pth::on_receive( b.ch, [&]( std::optional<long> v ) { sum += *v; } ) );
+    }
+    report( "channel", "select of 2 bounded(64)", elapsed_ns( start ), n );
+    a.ch.close();
+    b.ch.close();
+    while ( a.ch.try_receive() || b.ch.try_receive() ) { }
+}
+
+
+// Sender chains on a pth::exec::pool_scheduler run with sync_wait: a 
+// schedule | then round trip, when_all of four of them, and a triad over 
+// 4M doubles spread by bulk
+
+void bench_sender() {
+    namespace ex = pth::exec;
+    pth::fixed_pool pool( hardware_threads() );
+    ex::pool_scheduler sched( pool );
+
+    {
+        const long n = 100000;
+        long sum = 0;
+        auto start = bench_clock::now();
+        for ( long i = 0; i < n; i++ ) {
+            auto [v] = *ex::sync_wait( ex::schedule( sched ) | ex::then( [i] { return i; } ) );
+            sum += v;
+        }
+        report( "sender", "schedule | then", elapsed_ns( start ), n );
+        if ( sum != n * ( n - 1 ) / 2 ) std::cout << "sender: wrong schedule | then sum" << std::endl;
+    }
+    {
+        const long n = 50000;
+        auto part = [&]( long k ) { return ex::schedule( sched ) | ex::then( [k] { return k; } ); };
+        long sum = 0;
+        auto start = bench_clock::now();
+        for ( long i = 0; i < n; i++ ) {
+            auto [v] = *ex::sync_wait( ex::when_all( part( 1 ), part( 2 ), part( 3 ), part( 4 ) ) 
+                                       | ex::then( []( long a, long b, long c, long d ) { return a + b + c + d; } ) );
+            sum += v;
+        }
+        report( "sender", "when_all of 4", elapsed_ns( start ), n );
+        if ( sum != 10 * n ) std::cout << "sender: wrong when_all sum" << std::endl;
+    }
+    {
+        const long n = 4 * 1024 * 1024;
+        const int reps = 20;
+        std::vector<double> a( n, 0.0 ), b( n, 1.0 ), c( n, 2.0 );
+        auto start = bench_clock::now();
+        for ( auto r{0}; r < reps; r++ ) {
+            ex::sync_wait( ex::schedule( sched ) 
+                           | ex::then( [] { return 3.0; } ) 
+                           | ex::bulk( n, [&]( long i, double k ) { a[i] = b[i] + k * c[i]; } ) );
+        }
+        report( "sender", "bulk triad", elapsed_ns( start ), n * reps );
+        for ( long i = 0; i < n; i += 4093 ) {
+            if ( a[i] != 7.0 ) {
+                std::cout << "sender: wrong bulk triad result at " << i << std::endl;
+                break;
+            }
+        }
+    }
+}
+
+
+struct benchmark {
+    const char* name;
+    void (*run)();
+};
+
+const benchmark benchmarks[] = {
+    { "locks", bench_locks },
+    { "combining", bench_combining },
+    { "delegation", bench_delegation },
+    { "spawn", bench_spawn },
+    { "pool", bench_pool },
+    { "parallel", bench_parallel },
+    { "sort", bench_sort },
+    { "graph", bench_graph },
+    { "group", bench_group },
+    { "coro", bench_coro },
+    { "channel", bench_channel },
+    { "sender", bench_sender },
+};
+
+} // namespace
+
+
+int main( int argc, char** argv ) {
+
+    for ( const auto& b : benchmarks ) {
+        bool selected = argc < 2;
+        for ( auto i{1}; i < argc; i++ ) {
+            if ( std::strcmp( argv[i], b.name ) == 0 ) selected = true;
+        }
+        if ( selected ) b.run();
+    }
+
+}
@@ -1,5 +1,6 @@
 
 #include "pth.hxx"
+#include "pth_rt.hxx"
 #include <pthread.h>
 #include <unistd.h>
 
@@ -9,6 +10,7 @@
 #include <cstddef>
 #include <chrono>
 #include <ctime>
+#include <cstring>
 
 
 
@@ -28,6 +30,30 @@ void* func(void*) {
 };
 
 
+// Real-time classes need CAP_SYS_NICE (and SCHED_DEADLINE an unrestricted 
+// cpuset), without it the check reports the errno and moves on
+
+void* rt_func(void* done) {
+    static_cast<pth::semaphore*>(done)->acquire();
+    return nullptr;
+}
+
+void check_rt_scheduling(const char* name, const pth::scheduling& wanted) {
+    pth::semaphore done;
+    pth::rt_thread rt(wanted, rt_func, &done);
+    if ( rt.error() ) {
+        std::cout << name << " : skipped (" << std::strerror(rt.error()) << ")" << std::endl;
+        return;
+    }
+    pth::scheduling actual;
+    int err = rt.get_scheduling(actual);
+    done.release();
+    bool ok = !err && actual.policy == wanted.policy && actual.priority == wanted.priority &&
+              actual.runtime == wanted.runtime && actual.deadline == wanted.deadline;
+    std::cout << name << " : " << (ok ? "ok" : "policy mismatch") << std::endl;
+}
+
+
 int main() {
 
     const int num_threads = 50;
@@ -50,4 +76,9 @@ int main() {
         thread.join();
     }
 
+    using namespace std::chrono_literals;
+    check_rt_scheduling("SCHED_FIFO", pth::scheduling::fifo(10));
+    check_rt_scheduling("SCHED_RR", pth::scheduling::rr(10));
+    check_rt_scheduling("SCHED_DEADLINE", pth::scheduling::deadline_of(200us, 1ms, 1ms));
+
 }
@@ -21,9 +21,28 @@
 #include <ctime>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stop_token>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 
 // Some instrumentation
@@ -38,48 +57,224 @@
 namespace pth {
 
 
-class thread {
+// Low level building blocks for the spin-then-park primitives
+
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile( "yield" ::: "memory" );
+#else
+    std::atomic_signal_fence( std::memory_order_seq_cst );
+#endif
+}
+
+// Cheap monotonic tick counter, only meant for relative measurements on 
+// the same thread (TSC on x86, virtual counter on ARM, ns elsewhere)
+inline std::uint64_t cycles() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    std::uint64_t val;
+    asm volatile( "mrs %0, cntvct_el0" : "=r"(val) );
+    return val;
+#else
+    std::timespec ts;
+    ::clock_gettime( CLOCK_MONOTONIC, &ts );
+    return std::uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+namespace detail {
+
+// Result storage for an operation run on another thread
+template<class R>
+struct result_box {
+    std::optional<R> value;
+
+    template<class F, class... Args>
+    void set( F& f, Args&&... args ) { value.emplace( std::invoke( f, std::forward<Args>(args)... ) ); }
+    R get() { return std::move( *value ); }
+};
+
+template<class R>
+struct result_box<R&> {
+    R* value = nullptr;
+
+    template<class F, class... Args>
+    void set( F& f, Args&&... args ) { value = &std::invoke( f, std::forward<Args>(args)... ); }
+    R& get() { return *value; }
+};
+
+template<>
+struct result_box<void> {
+    template<class F, class... Args>
+    void set( F& f, Args&&... args ) { std::invoke( f, std::forward<Args>(args)... ); }
+    void get() { }
+};
+
+} // namespace detail
+
+static_assert( sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t) );
+
+// Returns 0 when woken, otherwise errno (EAGAIN if *word != expected, 
+// ETIMEDOUT, EINTR)
+inline int futex_wait( std::atomic<std::uint32_t>& word, std::uint32_t expected, 
+                       const std::timespec* reltime = nullptr ) noexcept {
+    long retval = ::syscall( SYS_futex, reinterpret_cast<std::uint32_t*>(&word), 
+                             FUTEX_WAIT_PRIVATE, expected, reltime, nullptr, 0 );
+    return retval == 0 ? 0 : errno;
+}
+
+inline int futex_wake( std::atomic<std::uint32_t>& word, int count = 1 ) noexcept {
+    return int( ::syscall( SYS_futex, reinterpret_cast<std::uint32_t*>(&word), 
+                           FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0 ) );
+}
+
+
+namespace detail {
+
+// Start block for threads running a callable with a stop token, freed by 
+// the new thread. A callable returning something convertible to void* hands 
+// it to join() like a plain start routine does.
+template<class F, class... Args>
+struct stoppable_start {
+    template<class G, class... A>
+    stoppable_start( std::stop_token st, G&& g, A&&... a ) 
+        : token( std::move( st ) ), fn( std::forward<G>(g) ), args( std::forward<A>(a)... ) { }
+
+    static void* run( void* self ) {
+        std::unique_ptr<stoppable_start> start( static_cast<stoppable_start*>(self) );
+        return std::apply( [&start]( auto&... a ) -> void* {
+            using R = std::invoke_result_t<F, std::stop_token, Args...>;
+            if constexpr ( std::is_convertible_v<R, void*> ) {
+                return std::invoke( std::move( start->fn ), start->token, std::move( a )... );
+            }
+            else {
+                std::invoke( std::move( start->fn ), start->token, std::move( a )... );
+                return nullptr;
+            }
+        }, start->args );
+    }
+
+    std::stop_token token;
+    F fn;
+    std::tuple<Args...> args;
+};
+
+} // namespace detail
+
+
+using stop_source = std::stop_source;
+using stop_token = std::stop_token;
+
+template<class Callback>
+using stop_callback = std::stop_callback<Callback>;
+
+
+namespace detail {
+
+inline std::timespec abstime_after( long nsec, ::clockid_t clock = CLOCK_REALTIME ) noexcept {
+
+    constexpr long NS_PER_SEC = 1000000000L;
+
+    std::timespec now, abstime;
+
+    ::clock_gettime( clock, &now );
+
+    abstime.tv_sec  =  now.tv_sec  + nsec / NS_PER_SEC;
+    abstime.tv_nsec =  now.tv_nsec + nsec % NS_PER_SEC;
+    long over = abstime.tv_nsec / NS_PER_SEC;
+    if ( over ) {
+        abstime.tv_nsec -= over * NS_PER_SEC;
+        abstime.tv_sec  += over;
+    }
+    return abstime;
+}
+
+} // namespace detail
+
+
+// End of life policies for basic_thread, applied to a still joinable thread 
+// when its handle is destroyed or assigned over.
+
+struct join_policy {
+    template<class Thread>
+    static void apply( Thread& t ) { t.join(); }
+};
+
+struct detach_policy {
+    template<class Thread>
+    static void apply( Thread& t ) { t.detach(); }
+};
+
+// request_stop() is a no-op for threads started without a stop token
+struct stop_join_policy {
+    template<class Thread>
+    static void apply( Thread& t ) { t.request_stop(); t.join(); }
+};
+
+// Bounded shutdown latency: wait up to Millis for the thread, then detach it 
+// so its resources are still reclaimed when it eventually exits
+template<long Millis, bool RequestStop = false>
+struct timed_join_policy {
+    template<class Thread>
+    static void apply( Thread& t ) {
+        if constexpr ( RequestStop ) t.request_stop();
+        if ( !t.timedjoin( Millis * 1000000L ) ) t.detach();
+    }
+};
+
+
+template<class DestroyPolicy = join_policy>
+class basic_thread {
 public:
-    thread( const ::pthread_attr_t& attrhandle, void* (*start_routine)(void*), void* arg = nullptr) noexcept
-        {            
-            int detachstate;
-            int retval = ::pthread_attr_getdetachstate (&attrhandle, &detachstate);
-            ASSERT_EQ0( retval );
-            if (detachstate == PTHREAD_CREATE_JOINABLE) { _joinable = true; }
-            else { _joinable = false; }
-
-            ASSERT_EQ0( ::pthread_create( &_handle, &attrhandle, start_routine, arg ) ); 
-        
-        }
+    basic_thread( const ::pthread_attr_t& attrhandle, void* (*start_routine)(void*), void* arg = nullptr) noexcept
+        { spawn( &attrhandle, start_routine, arg ); }
 
     // The POSIX standard requires threads to be joinable by default. The default setting of the detach 
     // state attribute in a newly initialized thread attributes object is PTHREAD_CREATE_JOINABLE. 
 
-    thread( void* (*start_routine)(void*), void* arg = nullptr ) noexcept
-        { 
-            _joinable = true;
-            ASSERT_EQ0( ::pthread_create( &_handle, nullptr, start_routine, arg ) ); 
-        }
+    basic_thread( void* (*start_routine)(void*), void* arg = nullptr ) noexcept
+        { spawn( nullptr, start_routine, arg ); }
+
+    // Stoppable threads: f( stop_token, args... ) runs on the new thread, and the 
+    // thread carries the matching stop_source 
+
+    template<class F, class... Args>
+        requires std::is_invocable_v<std::decay_t<F>, stop_token, std::decay_t<Args>...>
+    basic_thread( const ::pthread_attr_t& attrhandle, F&& f, Args&&... args )
+        { spawn_stoppable( &attrhandle, std::forward<F>(f), std::forward<Args>(args)... ); }
 
-    thread() noexcept : _handle(0L), _joinable(false) { }
+    template<class F, class... Args>
+        requires std::is_invocable_v<std::decay_t<F>, stop_token, std::decay_t<Args>...>
+    explicit basic_thread( F&& f, Args&&... args )
+        { spawn_stoppable( nullptr, std::forward<F>(f), std::forward<Args>(args)... ); }
+
+    basic_thread() noexcept : _handle(0L), _joinable(false) { }
         // Adapt default constructor behaviour to own use case 
 
-    ~thread() { 
-        if ( joinable() ) { join(); }
-        // For some use cases 'detach' or 'terminate' is a better fit here
+    ~basic_thread() { 
+        if ( joinable() ) { DestroyPolicy::apply( *this ); }
     }
     
-    thread( const thread& ) = delete;
-    thread& operator=( const thread& ) = delete;
+    basic_thread( const basic_thread& ) = delete;
+    basic_thread& operator=( const basic_thread& ) = delete;
 
-    thread(thread&& other) noexcept {
+    basic_thread(basic_thread&& other) noexcept {
         _handle = std::exchange(other._handle, 0L);
         _joinable = std::exchange(other._joinable, false);
+        _stop = std::exchange(other._stop, stop_source(std::nostopstate));
     }
 
-    thread& operator=(thread&& other) noexcept {
-        _handle = std::exchange(other._handle, 0L);
-        _joinable = std::exchange(other._joinable, false);
+    // The thread previously owned by this handle goes through DestroyPolicy
+    basic_thread& operator=(basic_thread&& other) noexcept {
+        if ( this != &other ) {
+            if ( joinable() ) { DestroyPolicy::apply( *this ); }
+            _handle = std::exchange(other._handle, 0L);
+            _joinable = std::exchange(other._joinable, false);
+            _stop = std::exchange(other._stop, stop_source(std::nostopstate));
+        }
         return *this;
     }
 
@@ -91,21 +286,96 @@ public:
     
     void join(void** retval = nullptr) {
         if ( joinable() ) {
-            ASSERT_EQ0( ::pthread_join( _handle, retval) );
+            int ret = ::pthread_join( _handle, retval );
+            ASSERT_EQ0( ret );
             _joinable = false; 
         }
     }
+
+    // Non-blocking and bounded joins, false if the thread is still running
+    bool tryjoin( void** retval = nullptr );
+    bool timedjoin( long nsec, void** retval = nullptr );
+
+    template<class Rep, class Period>
+    bool join_for( const std::chrono::duration<Rep, Period>& rel, void** retval = nullptr ) {
+        return timedjoin( long( std::chrono::duration_cast<std::chrono::nanoseconds>( rel ).count() ), retval );
+    }
     
     void detach() {
-         ASSERT_EQ0( ::pthread_detach( _handle ) );
+        if ( joinable() ) {
+            int ret = ::pthread_detach( _handle );
+            ASSERT_EQ0( ret );
+            _joinable = false;
+        }
     }
 
+    // No-ops returning false / an empty token for threads started without a 
+    // stop token
+    bool request_stop() noexcept { return _stop.request_stop(); }
+    stop_token get_stop_token() const noexcept { return _stop.get_token(); }
+    stop_source get_stop_source() const noexcept { return _stop; }
+
 private:
+
+    void spawn( const ::pthread_attr_t* attrhandle, void* (*start_routine)(void*), void* arg ) noexcept;
+
+    template<class F, class... Args>
+    void spawn_stoppable( const ::pthread_attr_t* attrhandle, F&& f, Args&&... args );
   
     ::pthread_t _handle;
     bool _joinable;
+    stop_source _stop{ std::nostopstate };
 };
 
+template<class DestroyPolicy>
+inline void basic_thread<DestroyPolicy>::spawn( const ::pthread_attr_t* attrhandle, 
+                                                void* (*start_routine)(void*), void* arg ) noexcept {
+    _joinable = true;
+    if ( attrhandle ) {
+        int detachstate;
+        int retval = ::pthread_attr_getdetachstate (attrhandle, &detachstate);
+        ASSERT_EQ0( retval );
+        _joinable = (detachstate == PTHREAD_CREATE_JOINABLE);
+    }
+    int retval = ::pthread_create( &_handle, attrhandle, start_routine, arg );
+    ASSERT_EQ0( retval );
+}
+
+template<class DestroyPolicy>
+template<class F, class... Args>
+inline void basic_thread<DestroyPolicy>::spawn_stoppable( const ::pthread_attr_t* attrhandle, F&& f, Args&&... args ) {
+    using start = detail::stoppable_start<std::decay_t<F>, std::decay_t<Args>...>;
+    _stop = stop_source();
+    spawn( attrhandle, start::run, new start( _stop.get_token(), std::forward<F>(f), std::forward<Args>(args)... ) );
+}
+
+template<class DestroyPolicy>
+inline bool basic_thread<DestroyPolicy>::tryjoin( void** retval ) {
+    if ( !joinable() ) return true;
+    int ret = ::pthread_tryjoin_np( _handle, retval );
+    if ( ret == EBUSY ) return false;
+    ASSERT_EQ0( ret );
+    _joinable = false;
+    return true;
+}
+
+template<class DestroyPolicy>
+inline bool basic_thread<DestroyPolicy>::timedjoin( long nsec, void** retval ) {
+    if ( !joinable() ) return true;
+    std::timespec abstime = detail::abstime_after( nsec );
+    int ret = ::pthread_timedjoin_np( _handle, retval, &abstime );
+    if ( ret == ETIMEDOUT ) return false;
+    ASSERT_EQ0( ret );
+    _joinable = false;
+    return true;
+}
+
+
+using thread = basic_thread<join_policy>;
+
+// Requests a stop before it joins, like std::jthread
+using jthread = basic_thread<stop_join_policy>;
+
 
 class rwlock {
 public:
@@ -177,6 +447,7 @@ public:
     ::pthread_mutex_t native_handle() { return _handle; }
 
 private:
+    friend class cond_var;   // waits need the mutex itself, not a copy
  
     ::pthread_mutex_t _handle;
 };
@@ -217,6 +488,84 @@ inline bool spinlock::trylock() {
 }
 
 
+// Exponential backoff with jitter for spinning waiters. Every call pauses for a 
+// random number of cpu_relax() rounds in [limit/2, limit], the limit doubles up 
+// to MaxSpins. After YieldAfter calls at the cap the waiter yields the cpu 
+// instead, so oversubscribed spinners don't starve a preempted lock holder.
+
+template<std::uint32_t MinSpins = 4, std::uint32_t MaxSpins = 1024, std::uint32_t YieldAfter = 8>
+class exp_backoff {
+public:
+    static_assert( MinSpins > 0 && MinSpins <= MaxSpins );
+
+    void operator()() noexcept;
+    void reset() noexcept { _limit = MinSpins; _capped = 0; }
+
+private:
+    static std::uint32_t jitter() noexcept;
+
+    std::uint32_t _limit = MinSpins;
+    std::uint32_t _capped = 0;
+};
+
+template<std::uint32_t MinSpins, std::uint32_t MaxSpins, std::uint32_t YieldAfter>
+inline std::uint32_t exp_backoff<MinSpins, MaxSpins, YieldAfter>::jitter() noexcept {
+    // xorshift32, seeded per thread from its stack address
+    static thread_local std::uint32_t state = std::uint32_t( reinterpret_cast<std::uintptr_t>(&state) >> 4 ) | 1u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+template<std::uint32_t MinSpins, std::uint32_t MaxSpins, std::uint32_t YieldAfter>
+inline void exp_backoff<MinSpins, MaxSpins, YieldAfter>::operator()() noexcept {
+    if ( _limit == MaxSpins && ++_capped > YieldAfter ) {
+        ::sched_yield();
+        return;
+    }
+    std::uint32_t spins = _limit / 2 + jitter() % ( _limit - _limit / 2 + 1 );
+    while ( spins-- ) cpu_relax();
+    _limit = _limit * 2 < MaxSpins ? _limit * 2 : MaxSpins;
+}
+
+
+// Userspace test-and-test-and-set spinlock. Waiters spin on a plain load and 
+// back off between attempts, so the lock's cache line is only written when 
+// it looked free.
+
+template<class Backoff = exp_backoff<>>
+class ttas_spinlock {
+public:
+    ttas_spinlock() = default;
+
+    ttas_spinlock( const ttas_spinlock& other ) = delete;
+    ttas_spinlock& operator=( const ttas_spinlock& other ) = delete;
+
+    void lock();
+    void unlock() { _locked.store( false, std::memory_order_release ); }
+    bool trylock();
+
+private:
+
+    std::atomic<bool> _locked{ false };
+};
+
+template<class Backoff>
+inline bool ttas_spinlock<Backoff>::trylock() {
+    return !_locked.load( std::memory_order_relaxed ) && 
+           !_locked.exchange( true, std::memory_order_acquire );
+}
+
+template<class Backoff>
+inline void ttas_spinlock<Backoff>::lock() {
+    Backoff backoff;
+    while ( !trylock() ) {
+        backoff();
+    }
+}
+
+
 
 class cond_var {
 public:
@@ -231,6 +580,7 @@ public:
     cond_var& operator=( const cond_var& other ) = delete;
 
     void wait( mutex& mtx );
+    bool wait( mutex& mtx, const stop_token& st );   // false when woken by a stop request
     int  timedwait( mutex& mtx, long nsec );
     void signal() {  ASSERT_EQ0( ::pthread_cond_signal( &_handle ) ); }
     void broadcast() {  ASSERT_EQ0( ::pthread_cond_broadcast( &_handle ) ); }
@@ -243,34 +593,623 @@ private:
 };
 
 inline void cond_var::wait( mutex& mtx ) {
-    ::pthread_mutex_t nh = mtx.native_handle();
-    ASSERT_EQ0( ::pthread_cond_wait( &_handle, &nh ) );
+    int retval = ::pthread_cond_wait( &_handle, &mtx._handle );
+    ASSERT_EQ0( retval );
 }
 
-inline int cond_var::timedwait( mutex& mtx, long nsec ) {
+// The stop callback can only broadcast safely while it holds mtx, which it 
+// gets exactly when the waiter sits in pthread_cond_wait. Once the waiter is 
+// back it flags the callback off. Don't request the stop while holding mtx.
+inline bool cond_var::wait( mutex& mtx, const stop_token& st ) {
+    std::atomic<bool> returned{ false };
+    const ::pthread_t waiter = ::pthread_self();
+
+    auto wake = [this, &mtx, &returned, waiter] {
+        if ( ::pthread_equal( ::pthread_self(), waiter ) ) return;   // stop requested before registration
+        while ( !returned.load( std::memory_order_acquire ) ) {
+            if ( mtx.trylock() ) {
+                broadcast();
+                mtx.unlock();
+                return;
+            }
+            ::sched_yield();
+        }
+    };
+    stop_callback<decltype(wake)> callback( st, wake );
 
-    constexpr long NS_PER_SEC = 1000000000L;
+    if ( st.stop_requested() ) return false;
+    int retval = ::pthread_cond_wait( &_handle, &mtx._handle );
+    returned.store( true, std::memory_order_release );
+    ASSERT_EQ0( retval );
+    return !st.stop_requested();
+}
 
-    std::timespec now, abstime;
+inline int cond_var::timedwait( mutex& mtx, long nsec ) {
 
-    ::clock_gettime( CLOCK_REALTIME, &now );  // hardware and os setup may require a
-                                              // different clock like CLOCK_MONOTONIC
-    
-    abstime.tv_sec  =  now.tv_sec  + nsec / NS_PER_SEC;
-    abstime.tv_nsec =  now.tv_nsec + nsec % NS_PER_SEC;
-    long over = abstime.tv_nsec / NS_PER_SEC;
-    if ( abstime.tv_nsec / NS_PER_SEC ) {
-        abstime.tv_nsec -= over * NS_PER_SEC;
-        abstime.tv_sec  += over;
-    }
+    // hardware and os setup may require a different clock like CLOCK_MONOTONIC
+    std::timespec abstime = detail::abstime_after( nsec, CLOCK_REALTIME );
 
-    ::pthread_mutex_t nh = mtx.native_handle();
-    int retval = ::pthread_cond_timedwait( &_handle, &nh, &abstime );
+    int retval = ::pthread_cond_timedwait( &_handle, &mtx._handle, &abstime );
     if ( retval == ETIMEDOUT ) return ETIMEDOUT;
     ASSERT_EQ0( retval ); 
     return 0;
 }
 
+
+
+// Spin policies for the spin-then-park primitives below. A policy hands out a 
+// spin budget in cycles() ticks, and is told whether the last spin phase 
+// acquired the resource and, for locks, how long the resource was held.
+
+struct no_spin {
+    std::uint64_t budget() const noexcept { return 0; }
+    void spun( bool ) noexcept { }
+    void held( std::uint64_t ) noexcept { }
+};
+
+template<std::uint64_t Ticks>
+struct fixed_spin {
+    std::uint64_t budget() const noexcept { return Ticks; }
+    void spun( bool ) noexcept { }
+    void held( std::uint64_t ) noexcept { }
+};
+
+// Per instance adaptive budget: grows while spinning succeeds, halves when a 
+// spinner had to park anyway, and is capped by a multiple of the observed 
+// hold time. Long critical sections (hold time beyond max_budget, roughly 
+// what a futex round trip costs) disable spinning until hold times drop. 
+// The state is updated racily with relaxed atomics, it is only a heuristic.
+class adaptive_spin {
+public:
+    static constexpr std::uint64_t min_budget = 64;
+    static constexpr std::uint64_t max_budget = 1 << 15;
+
+    std::uint64_t budget() const noexcept;
+    void spun( bool acquired ) noexcept;
+    void held( std::uint64_t ticks ) noexcept;
+
+private:
+    std::uint64_t ceiling() const noexcept;
+
+    std::atomic<std::uint64_t> _budget{ max_budget / 8 };
+    std::atomic<std::uint64_t> _hold{ 0 };  // EWMA of hold times, 0 = unknown
+};
+
+inline std::uint64_t adaptive_spin::budget() const noexcept {
+    if ( _hold.load( std::memory_order_relaxed ) > max_budget ) return 0;
+    return _budget.load( std::memory_order_relaxed );
+}
+
+inline std::uint64_t adaptive_spin::ceiling() const noexcept {
+    std::uint64_t hold = _hold.load( std::memory_order_relaxed );
+    if ( hold == 0 ) return max_budget;
+    if ( hold > max_budget ) return min_budget;
+    return hold * 8 < max_budget ? hold * 8 : max_budget;
+}
+
+inline void adaptive_spin::spun( bool acquired ) noexcept {
+    std::uint64_t b = _budget.load( std::memory_order_relaxed );
+    b = acquired ? b + b / 4 + min_budget : b / 2;
+    std::uint64_t hi = ceiling();
+    if ( b > hi ) b = hi;
+    if ( b < min_budget ) b = min_budget;
+    _budget.store( b, std::memory_order_relaxed );
+}
+
+inline void adaptive_spin::held( std::uint64_t ticks ) noexcept {
+    std::uint64_t h = _hold.load( std::memory_order_relaxed );
+    h = h == 0 ? ticks + 1 : h - h / 8 + ticks / 8;
+    _hold.store( h, std::memory_order_relaxed );
+}
+
+
+// Futex based mutex (0 unlocked, 1 locked, 2 locked with sleepers) which 
+// spins for the policy's budget before it parks. Not recursive, and any 
+// thread may unlock it.
+
+template<class SpinPolicy = adaptive_spin>
+class basic_hybrid_mutex {
+public:
+    basic_hybrid_mutex() = default;
+
+    basic_hybrid_mutex( const basic_hybrid_mutex& other ) = delete;
+    basic_hybrid_mutex& operator=( const basic_hybrid_mutex& other ) = delete;
+
+    void lock();
+    void unlock();
+    bool trylock();
+
+    SpinPolicy& policy() noexcept { return _policy; }
+
+private:
+
+    // Reading the tick counter is not free (tens of ns virtualized), so only 
+    // every sample_rate-th critical section is timed
+    static constexpr std::uint32_t sample_rate = 16;
+
+    void stamp() noexcept { _acquired = ++_acquisitions % sample_rate ? 0 : cycles(); }
+
+    std::atomic<std::uint32_t> _state{ 0 };
+    std::uint32_t _acquisitions{ 0 };
+    std::uint64_t _acquired{ 0 };
+    SpinPolicy _policy;
+};
+
+template<class SpinPolicy>
+inline bool basic_hybrid_mutex<SpinPolicy>::trylock() {
+    std::uint32_t c = 0;
+    if ( !_state.compare_exchange_strong( c, 1, std::memory_order_acquire, std::memory_order_relaxed ) ) 
+        return false;
+    stamp();
+    return true;
+}
+
+template<class SpinPolicy>
+inline void basic_hybrid_mutex<SpinPolicy>::lock() {
+    if ( trylock() ) return;
+
+    const std::uint64_t budget = _policy.budget();
+    if ( budget ) {
+        const std::uint64_t start = cycles();
+        do {
+            cpu_relax();
+            if ( _state.load( std::memory_order_relaxed ) == 0 && trylock() ) {
+                _policy.spun( true );
+                return;
+            }
+        } while ( cycles() - start < budget );
+        _policy.spun( false );
+    }
+
+    std::uint32_t c = _state.exchange( 2, std::memory_order_acquire );
+    while ( c != 0 ) {
+        futex_wait( _state, 2 );
+        c = _state.exchange( 2, std::memory_order_acquire );
+    }
+    stamp();
+}
+
+template<class SpinPolicy>
+inline void basic_hybrid_mutex<SpinPolicy>::unlock() {
+    if ( _acquired ) _policy.held( cycles() - _acquired );
+    if ( _state.exchange( 0, std::memory_order_release ) == 2 ) {
+        futex_wake( _state, 1 );
+    }
+}
+
+using hybrid_mutex = basic_hybrid_mutex<adaptive_spin>;
+
+
+// Counting semaphore on the same spin-then-park scheme 
+
+template<class SpinPolicy = adaptive_spin>
+class basic_semaphore {
+public:
+    explicit basic_semaphore( std::uint32_t count = 0 ) : _count( count ) { }
+
+    basic_semaphore( const basic_semaphore& other ) = delete;
+    basic_semaphore& operator=( const basic_semaphore& other ) = delete;
+
+    void acquire();
+    bool tryacquire();
+    void release( std::uint32_t n = 1 );
+
+    SpinPolicy& policy() noexcept { return _policy; }
+
+private:
+
+    std::atomic<std::uint32_t> _count;
+    std::atomic<std::uint32_t> _sleepers{ 0 };
+    SpinPolicy _policy;
+};
+
+template<class SpinPolicy>
+inline bool basic_semaphore<SpinPolicy>::tryacquire() {
+    std::uint32_t c = _count.load( std::memory_order_relaxed );
+    while ( c != 0 ) {
+        if ( _count.compare_exchange_weak( c, c - 1, std::memory_order_acquire, std::memory_order_relaxed ) ) 
+            return true;
+    }
+    return false;
+}
+
+template<class SpinPolicy>
+inline void basic_semaphore<SpinPolicy>::acquire() {
+    if ( tryacquire() ) return;
+
+    const std::uint64_t budget = _policy.budget();
+    if ( budget ) {
+        const std::uint64_t start = cycles();
+        do {
+            cpu_relax();
+            if ( tryacquire() ) {
+                _policy.spun( true );
+                return;
+            }
+        } while ( cycles() - start < budget );
+        _policy.spun( false );
+    }
+
+    _sleepers.fetch_add( 1, std::memory_order_seq_cst );
+    while ( !tryacquire() ) {
+        futex_wait( _count, 0 );
+    }
+    _sleepers.fetch_sub( 1, std::memory_order_relaxed );
+}
+
+template<class SpinPolicy>
+inline void basic_semaphore<SpinPolicy>::release( std::uint32_t n ) {
+    _count.fetch_add( n, std::memory_order_seq_cst );
+    if ( _sleepers.load( std::memory_order_seq_cst ) ) {
+        futex_wake( _count, int(n) );
+    }
+}
+
+using semaphore = basic_semaphore<adaptive_spin>;
+
+
+// NUMA topology without libnuma: node count from sysfs, node of the calling 
+// thread from getcpu(2)
+
+namespace numa {
+
+inline int node_count() {
+    static const int count = [] {
+        int highest = 0;
+        if ( std::FILE* f = std::fopen( "/sys/devices/system/node/possible", "r" ) ) {
+            int node;
+            char sep;
+            while ( std::fscanf( f, "%d", &node ) == 1 ) {
+                if ( node > highest ) highest = node;
+                if ( std::fscanf( f, "%c", &sep ) != 1 || sep == '\n' ) break;
+            }
+            std::fclose( f );
+        }
+        return highest + 1;
+    }();
+    return count;
+}
+
+inline int current_node() noexcept {
+    unsigned cpu = 0, node = 0;
+    if ( ::getcpu( &cpu, &node ) != 0 ) return 0;   // vDSO backed, no syscall
+    return int(node);
+}
+
+} // namespace numa
+
+
+// Cohort lock: a global lock plus one local lock per NUMA node. Releasing 
+// threads hand the global lock to a waiter on their own node, at most 
+// max_handoffs times in a row before it goes back to the other nodes. 
+// The global lock is released by whichever thread ends the batch, so it must 
+// not be owner checked.
+
+template<class GlobalLock = hybrid_mutex>
+class cohort_lock {
+public:
+    explicit cohort_lock( std::uint32_t max_handoffs = 64 )
+        : _nodes( new local_lock[numa::node_count()] ), _num_nodes( numa::node_count() ), 
+          _max_handoffs( max_handoffs ) { }
+
+    cohort_lock( const cohort_lock& other ) = delete;
+    cohort_lock& operator=( const cohort_lock& other ) = delete;
+
+    void lock();
+    void unlock();
+    bool trylock();
+
+private:
+
+    struct alignas(64) local_lock {
+        hybrid_mutex mtx;
+        std::atomic<std::uint32_t> waiters{ 0 };
+        bool global_held = false;      // guarded by mtx
+        std::uint32_t handoffs = 0;    // ditto
+    };
+
+    local_lock& this_node() noexcept { return _nodes[numa::current_node() % _num_nodes]; }
+
+    GlobalLock _global;
+    std::unique_ptr<local_lock[]> _nodes;
+    int _num_nodes;
+    std::uint32_t _max_handoffs;
+    local_lock* _holder = nullptr;     // node of the current owner
+};
+
+template<class GlobalLock>
+inline void cohort_lock<GlobalLock>::lock() {
+    local_lock& local = this_node();
+
+    if ( !local.mtx.trylock() ) {
+        local.waiters.fetch_add( 1, std::memory_order_relaxed );
+        local.mtx.lock();
+        local.waiters.fetch_sub( 1, std::memory_order_relaxed );
+    }
+
+    if ( !local.global_held ) {
+        _global.lock();
+        local.global_held = true;
+    }
+    _holder = &local;
+}
+
+template<class GlobalLock>
+inline bool cohort_lock<GlobalLock>::trylock() {
+    local_lock& local = this_node();
+
+    if ( !local.mtx.trylock() ) return false;
+
+    if ( !local.global_held ) {
+        if ( !_global.trylock() ) {
+            local.mtx.unlock();
+            return false;
+        }
+        local.global_held = true;
+    }
+    _holder = &local;
+    return true;
+}
+
+template<class GlobalLock>
+inline void cohort_lock<GlobalLock>::unlock() {
+    local_lock& local = *_holder;
+
+    if ( local.waiters.load( std::memory_order_relaxed ) && local.handoffs < _max_handoffs ) {
+        local.handoffs++;
+    }
+    else {
+        local.handoffs = 0;
+        local.global_held = false;
+        _global.unlock();
+    }
+    local.mtx.unlock();
+}
+
+
+// Threads reaped in completion order. Members started through the group 
+// report their exit (also on pthread_exit / cancellation unwinding), so 
+// join_any() picks up whichever finished first without a helper thread 
+// per join. Ids are handed out by spawn() and never reused.
+
+class thread_group {
+public:
+    static constexpr std::size_t npos = std::size_t(-1);
+
+    thread_group() = default;
+    ~thread_group() { join_all(); }
+
+    thread_group( const thread_group& other ) = delete;
+    thread_group& operator=( const thread_group& other ) = delete;
+
+    std::size_t spawn( const ::pthread_attr_t& attrhandle, void* (*start_routine)(void*), void* arg = nullptr );
+    std::size_t spawn( void* (*start_routine)(void*), void* arg = nullptr );
+
+    // Join the first member to finish and return its id, npos if the group is 
+    // empty (or, for the bounded versions, nobody finished in time)
+    std::size_t join_any( void** retval = nullptr );
+    std::size_t tryjoin_any( void** retval = nullptr );
+    std::size_t timedjoin_any( long nsec, void** retval = nullptr );
+
+    void join_all();
+
+    std::size_t size() const noexcept { return _members.size(); }
+
+private:
+
+    struct start_block {
+        thread_group* group;
+        std::size_t id;
+        void* (*start_routine)(void*);
+        void* arg;
+    };
+
+    struct member {
+        std::size_t id;
+        thread handle;
+    };
+
+    static void* start( void* block );
+    void finished( std::size_t id );
+    std::size_t reap( void** retval );
+    std::size_t spawn( const ::pthread_attr_t* attrhandle, void* (*start_routine)(void*), void* arg );
+
+    std::vector<member> _members;         // owner side only
+    std::size_t _next_id = 0;
+
+    hybrid_mutex _lock;                   // guards _finished
+    std::deque<std::size_t> _finished;
+    std::atomic<std::uint32_t> _exits{ 0 };
+};
+
+inline void* thread_group::start( void* block ) {
+    start_block b = *static_cast<start_block*>(block);
+    delete static_cast<start_block*>(block);
+
+    struct reporter {
+        start_block& b;
+        ~reporter() { b.group->finished( b.id ); }
+    } report{ b };
+    return b.start_routine( b.arg );
+}
+
+inline void thread_group::finished( std::size_t id ) {
+    _lock.lock();
+    _finished.push_back( id );
+    _lock.unlock();
+    _exits.fetch_add( 1, std::memory_order_release );
+    futex_wake( _exits, INT_MAX );
+}
+
+inline std::size_t thread_group::spawn( const ::pthread_attr_t* attrhandle, void* (*start_routine)(void*), void* arg ) {
+    const std::size_t id = _next_id++;
+    auto* block = new start_block{ this, id, start_routine, arg };
+    _members.push_back( member{ id, attrhandle ? thread( *attrhandle, start, block ) : thread( start, block ) } );
+    return id;
+}
+
+inline std::size_t thread_group::spawn( const ::pthread_attr_t& attrhandle, void* (*start_routine)(void*), void* arg ) {
+    return spawn( &attrhandle, start_routine, arg );
+}
+
+inline std::size_t thread_group::spawn( void* (*start_routine)(void*), void* arg ) {
+    return spawn( nullptr, start_routine, arg );
+}
+
+inline std::size_t thread_group::reap( void** retval ) {
+    _lock.lock();
+    if ( _finished.empty() ) {
+        _lock.unlock();
+        return npos;
+    }
+    const std::size_t id = _finished.front();
+    _finished.pop_front();
+    _lock.unlock();
+
+    for ( auto it = _members.begin(); it != _members.end(); ++it ) {
+        if ( it->id == id ) {
+            it->handle.join( retval );    // it is past its start routine already
+            *it = std::move( _members.back() );
+            _members.pop_back();
+            break;
+        }
+    }
+    return id;
+}
+
+inline std::size_t thread_group::tryjoin_any( void** retval ) {
+    return reap( retval );
+}
+
+inline std::size_t thread_group::join_any( void** retval ) {
+    while ( !_members.empty() ) {
+        const std::uint32_t exits = _exits.load( std::memory_order_acquire );
+        std::size_t id = reap( retval );
+        if ( id != npos ) return id;
+        futex_wait( _exits, exits );
+    }
+    return npos;
+}
+
+inline std::size_t thread_group::timedjoin_any( long nsec, void** retval ) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds( nsec );
+    while ( !_members.empty() ) {
+        const std::uint32_t exits = _exits.load( std::memory_order_acquire );
+        std::size_t id = reap( retval );
+        if ( id != npos ) return id;
+        const long long left = std::chrono::duration_cast<std::chrono::nanoseconds>( 
+                                   deadline - std::chrono::steady_clock::now() ).count();
+        if ( left <= 0 ) break;
+        std::timespec reltime{ std::time_t( left / 1000000000LL ), long( left % 1000000000LL ) };
+        futex_wait( _exits, exits, &reltime );
+    }
+    return npos;
+}
+
+inline void thread_group::join_all() {
+    for ( auto& m : _members ) m.handle.join();
+    _members.clear();
+    _lock.lock();
+    _finished.clear();
+    _lock.unlock();
+}
+
+
+// Move-only void() callable for executors. Callables that are trivially 
+// copyable and fit into InlineSize bytes (pointer alignment at most), which 
+// covers lambdas capturing pointers, references and scalars, are stored 
+// inline; anything else is moved to the heap and only its pointer is kept. 
+// Either way the task itself is trivially relocatable: moving it is a copy of 
+// its bytes, so queues and pools may memcpy tasks around, as long as the 
+// source is not destroyed afterwards (release_relocated()).
+
+template<std::size_t InlineSize = 48>
+class basic_task {
+public:
+    static constexpr std::size_t inline_size = InlineSize;
+
+    template<class F>
+    static constexpr bool stored_inline = std::is_trivially_copyable_v<std::decay_t<F>> 
+                                          && sizeof(std::decay_t<F>) <= InlineSize 
+                                          && alignof(std::decay_t<F>) <= alignof(void*);
+
+    basic_task() noexcept = default;
+
+    template<class F>
+        requires ( !std::is_same_v<std::decay_t<F>, basic_task> && std::is_invocable_v<std::decay_t<F>&> )
+    basic_task( F&& f );
+
+    ~basic_task() { reset(); }
+
+    basic_task( const basic_task& other ) = delete;
+    basic_task& operator=( const basic_task& other ) = delete;
+
+    basic_task( basic_task&& other ) noexcept { relocate( other ); }
+
+    basic_task& operator=( basic_task&& other ) noexcept {
+        if ( this != &other ) {
+            reset();
+            relocate( other );
+        }
+        return *this;
+    }
+
+    explicit operator bool() const noexcept { return _call != nullptr; }
+
+    void operator()() { _call( invoke_action, _storage ); }
+
+    void reset() noexcept {
+        if ( _call ) std::exchange( _call, nullptr )( destroy_action, _storage );
+    }
+
+    // For containers that have copied the bytes of this task elsewhere
+    void release_relocated() noexcept { _call = nullptr; }
+
+private:
+
+    enum action { invoke_action, destroy_action };
+
+    template<class F>
+    static void call_inline( action a, unsigned char* storage ) {
+        if ( a == invoke_action ) std::invoke( *std::launder( reinterpret_cast<F*>(storage) ) );
+    }
+
+    template<class F>
+    static void call_heap( action a, unsigned char* storage ) {
+        F* f;
+        std::memcpy( &f, storage, sizeof(f) );
+        if ( a == invoke_action ) std::invoke( *f );
+        else delete f;
+    }
+
+    void relocate( basic_task& other ) noexcept {
+        std::memcpy( static_cast<void*>( this ), &other, sizeof(basic_task) );
+        other._call = nullptr;
+    }
+
+    void (*_call)( action, unsigned char* ) = nullptr;
+    alignas(void*) unsigned char _storage[InlineSize];
+};
+
+template<std::size_t InlineSize>
+template<class F>
+    requires ( !std::is_same_v<std::decay_t<F>, basic_task<InlineSize>> && std::is_invocable_v<std::decay_t<F>&> )
+inline basic_task<InlineSize>::basic_task( F&& f ) {
+    using D = std::decay_t<F>;
+    if constexpr ( stored_inline<F> ) {
+        ::new ( static_cast<void*>( _storage ) ) D( std::forward<F>(f) );
+        _call = call_inline<D>;
+    }
+    else {
+        static_assert( sizeof(D*) <= InlineSize, "no room for the heap pointer" );
+        D* heap = new D( std::forward<F>(f) );
+        std::memcpy( _storage, &heap, sizeof(heap) );
+        _call = call_heap<D>;
+    }
+}
+
+using task = basic_task<48>;
+
 } // namespace pth
 
 #endif // PTH_HXX
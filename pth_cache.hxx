@@ -0,0 +1,371 @@
+//
+//
+//  Thread reuse for pth. Finished threads park in a cache instead of exiting, 
+//  and new threads with matching attributes (stack, guard, scheduling) are 
+//  taken from there, which avoids the stack mmap and clone of pthread_create 
+//  on hot paths.
+//
+//
+
+
+#ifndef PTH_CACHE_HXX
+#define PTH_CACHE_HXX
+
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "pth.hxx"
+
+
+namespace pth {
+
+class thread_cache;
+
+
+// Handle to a job running on a cached thread, used like a pth::thread. 
+// It must not outlive its cache. If no thread could be created for the job, 
+// error() holds the pthread_create error and the handle is not joinable.
+
+class cached_thread {
+public:
+    cached_thread() noexcept = default;
+    ~cached_thread() { if ( joinable() ) join(); }
+
+    cached_thread( const cached_thread& ) = delete;
+    cached_thread& operator=( const cached_thread& ) = delete;
+
+    cached_thread( cached_thread&& other ) noexcept 
+        : _worker( std::exchange( other._worker, nullptr ) ), _error( std::exchange( other._error, 0 ) ) { }
+
+    cached_thread& operator=( cached_thread&& other ) noexcept {
+        if ( this != &other ) {
+            if ( joinable() ) join();
+            _worker = std::exchange( other._worker, nullptr );
+            _error = std::exchange( other._error, 0 );
+        }
+        return *this;
+    }
+
+    bool joinable() const noexcept { return _worker != nullptr; }
+    int error() const noexcept { return _error; }
+
+    void join( void** retval = nullptr );
+    bool tryjoin( void** retval = nullptr );
+    void detach();
+
+private:
+    friend class thread_cache;
+
+    struct worker;
+
+    explicit cached_thread( worker* w ) noexcept : _worker( w ) { }
+
+    worker* _worker = nullptr;
+    int _error = 0;
+};
+
+
+class thread_cache {
+public:
+    // Up to max_idle parked threads per attribute set, parked threads exit 
+    // after idle_ms without work
+    explicit thread_cache( std::size_t max_idle = 64, long idle_ms = 10000 ) 
+        : _max_idle( max_idle ), _idle_ms( idle_ms ) { }
+
+    // Waits for all cached threads to exit, handles must be joined or detached
+    ~thread_cache();
+
+    thread_cache( const thread_cache& other ) = delete;
+    thread_cache& operator=( const thread_cache& other ) = delete;
+
+    // Only stack size, guard size and scheduling attributes are honoured, the 
+    // detach state is taken from the handle
+    cached_thread spawn( const ::pthread_attr_t& attrhandle, void* (*start_routine)(void*), void* arg = nullptr );
+    cached_thread spawn( void* (*start_routine)(void*), void* arg = nullptr );
+
+    std::size_t idle() noexcept;
+
+private:
+    friend class cached_thread;
+
+    struct key {
+        std::size_t stacksize = 0;
+        std::size_t guardsize = 0;
+        int inheritsched = PTHREAD_INHERIT_SCHED;
+        int policy = SCHED_OTHER;
+        int priority = 0;
+
+        bool operator==( const key& ) const = default;
+    };
+
+    using worker = cached_thread::worker;
+
+    static key make_key( const ::pthread_attr_t* attrhandle ) noexcept;
+    static void* run( void* w );
+    static void finish( worker* w );
+
+    cached_thread launch( const key& k, void* (*start_routine)(void*), void* arg );
+    bool park( worker* w );
+    bool retire( worker* w );
+
+    std::size_t _max_idle;
+    long _idle_ms;
+
+    hybrid_mutex _lock;                                          // guards everything below
+    std::vector<std::pair<key, std::vector<worker*>>> _parked;
+    bool _closing = false;
+    alignas(64) std::atomic<std::uint32_t> _live{ 0 };
+};
+
+
+struct cached_thread::worker {
+    static constexpr std::uint32_t idle = 0;
+    static constexpr std::uint32_t running = 1;
+    static constexpr std::uint32_t finished = 2;
+    static constexpr std::uint32_t released = 3;
+    static constexpr std::uint32_t detached = 4;
+    static constexpr std::uint32_t quit = 5;
+
+    thread_cache* cache;
+    thread_cache::key attrs;
+    void* (*start_routine)(void*) = nullptr;
+    void* arg = nullptr;
+    void* retval = nullptr;
+    bool parked = false;                         // guarded by the cache lock
+    std::atomic<std::uint32_t> state{ idle };
+};
+
+
+inline void cached_thread::join( void** retval ) {
+    std::uint32_t s;
+    while ( ( s = _worker->state.load( std::memory_order_acquire ) ) != worker::finished ) {
+        futex_wait( _worker->state, s );
+    }
+    if ( retval ) *retval = _worker->retval;
+    _worker->state.store( worker::released, std::memory_order_release );
+    futex_wake( _worker->state, 1 );
+    _worker = nullptr;
+}
+
+inline bool cached_thread::tryjoin( void** retval ) {
+    if ( _worker->state.load( std::memory_order_acquire ) != worker::finished ) return false;
+    join( retval );
+    return true;
+}
+
+inline void cached_thread::detach() {
+    std::uint32_t s = worker::running;
+    if ( !_worker->state.compare_exchange_strong( s, worker::detached, std::memory_order_acq_rel ) ) {
+        join();     // finished already, just let it go
+        return;
+    }
+    _worker = nullptr;
+}
+
+
+inline thread_cache::key thread_cache::make_key( const ::pthread_attr_t* attrhandle ) noexcept {
+    key k;
+    ::pthread_attr_t defaults;
+    if ( !attrhandle ) {
+        ::pthread_attr_init( &defaults );
+        attrhandle = &defaults;
+    }
+    ::sched_param param{};
+    ::pthread_attr_getstacksize( attrhandle, &k.stacksize );
+    ::pthread_attr_getguardsize( attrhandle, &k.guardsize );
+    ::pthread_attr_getinheritsched( attrhandle, &k.inheritsched );
+    ::pthread_attr_getschedpolicy( attrhandle, &k.policy );
+    ::pthread_attr_getschedparam( attrhandle, &param );
+    k.priority = param.sched_priority;
+    if ( attrhandle == &defaults ) ::pthread_attr_destroy( &defaults );
+    return k;
+}
+
+inline cached_thread thread_cache::spawn( const ::pthread_attr_t& attrhandle, void* (*start_routine)(void*), void* arg ) {
+    return launch( make_key( &attrhandle ), start_routine, arg );
+}
+
+inline cached_thread thread_cache::spawn( void* (*start_routine)(void*), void* arg ) {
+    return launch( make_key( nullptr ), start_routine, arg );
+}
+
+inline cached_thread thread_cache::launch( const key& k, void* (*start_routine)(void*), void* arg ) {
+    worker* w = nullptr;
+
+    _lock.lock();
+    for ( auto& [attrs, list] : _parked ) {
+        if ( attrs == k && !list.empty() ) {
+            w = list.back();
+            list.pop_back();
+            w->parked = false;
+            break;
+        }
+    }
+    _lock.unlock();
+
+    if ( w ) {
+        w->start_routine = start_routine;
+        w->arg = arg;
+        w->state.store( worker::running, std::memory_order_release );
+        futex_wake( w->state, 1 );
+        return cached_thread( w );
+    }
+
+    w = new worker{ this, k, start_routine, arg };
+    w->state.store( worker::running, std::memory_order_relaxed );
+
+    ::pthread_attr_t attr;
+    int retval = ::pthread_attr_init( &attr );
+    ASSERT_EQ0( retval );
+    ::pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    ::pthread_attr_setstacksize( &attr, k.stacksize );
+    ::pthread_attr_setguardsize( &attr, k.guardsize );
+    ::pthread_attr_setinheritsched( &attr, k.inheritsched );
+    if ( k.inheritsched == PTHREAD_EXPLICIT_SCHED ) {
+        ::sched_param param{};
+        param.sched_priority = k.priority;
+        ::pthread_attr_setschedpolicy( &attr, k.policy );
+        ::pthread_attr_setschedparam( &attr, &param );
+    }
+    _live.fetch_add( 1, std::memory_order_relaxed );
+    ::pthread_t handle;
+    retval = ::pthread_create( &handle, &attr, run, w );
+    ::pthread_attr_destroy( &attr );
+
+    if ( retval ) {
+        delete w;
+        if ( _live.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) futex_wake( _live, INT_MAX );
+        cached_thread failed;
+        failed._error = retval;
+        return failed;
+    }
+    return cached_thread( w );
+}
+
+// Back into the idle list after a job, false if the thread should exit instead
+inline bool thread_cache::park( worker* w ) {
+    _lock.lock();
+    if ( _closing ) {
+        _lock.unlock();
+        return false;
+    }
+    auto it = std::find_if( _parked.begin(), _parked.end(), [w]( auto& p ) { return p.first == w->attrs; } );
+    if ( it == _parked.end() ) it = _parked.insert( _parked.end(), { w->attrs, {} } );
+    if ( it->second.size() >= _max_idle ) {
+        _lock.unlock();
+        return false;
+    }
+    w->state.store( worker::idle, std::memory_order_relaxed );
+    w->parked = true;
+    it->second.push_back( w );
+    _lock.unlock();
+    return true;
+}
+
+// After an idle timeout, false if a spawn picked the thread up meanwhile
+inline bool thread_cache::retire( worker* w ) {
+    _lock.lock();
+    bool out = w->parked;
+    if ( out ) {
+        for ( auto& [attrs, list] : _parked ) {
+            if ( attrs == w->attrs ) list.erase( std::find( list.begin(), list.end(), w ) );
+        }
+        w->parked = false;
+    }
+    _lock.unlock();
+    return out;
+}
+
+// Publishes the end of a job, waits until a joiner has taken the result
+inline void thread_cache::finish( worker* w ) {
+    if ( w->state.exchange( worker::finished, std::memory_order_acq_rel ) != worker::detached ) {
+        futex_wake( w->state, 1 );
+        std::uint32_t s;
+        while ( ( s = w->state.load( std::memory_order_acquire ) ) != worker::released ) {
+            futex_wait( w->state, s );
+        }
+    }
+}
+
+inline void* thread_cache::run( void* self ) {
+    worker* w = static_cast<worker*>(self);
+    thread_cache* cache = w->cache;
+    const long idle_ns = cache->_idle_ms * 1000000L;
+
+    // Also runs when a start routine calls pthread_exit() or is cancelled, 
+    // its job then ends with PTHREAD_CANCELED and the thread is not reused
+    struct reporter {
+        worker* w;
+        thread_cache* cache;
+        bool busy = false;
+        ~reporter() {
+            if ( busy ) finish( w );
+            delete w;
+            if ( cache->_live.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) {
+                futex_wake( cache->_live, INT_MAX );    // nothing of the cache is touched after this
+            }
+        }
+    } report{ w, cache };
+
+    for ( ;; ) {
+        report.busy = true;
+        w->retval = PTHREAD_CANCELED;
+        w->retval = w->start_routine( w->arg );
+        report.busy = false;
+        finish( w );
+
+        if ( !cache->park( w ) ) break;
+
+        std::timespec reltime{ std::time_t( idle_ns / 1000000000L ), idle_ns % 1000000000L };
+        std::uint32_t s;
+        while ( ( s = w->state.load( std::memory_order_acquire ) ) == worker::idle ) {
+            if ( futex_wait( w->state, worker::idle, &reltime ) == ETIMEDOUT && cache->retire( w ) ) {
+                s = worker::quit;
+                break;
+            }
+        }
+        if ( s == worker::quit ) break;
+    }
+    return nullptr;
+}
+
+inline std::size_t thread_cache::idle() noexcept {
+    std::size_t count = 0;
+    _lock.lock();
+    for ( auto& p : _parked ) count += p.second.size();
+    _lock.unlock();
+    return count;
+}
+
+inline thread_cache::~thread_cache() {
+    _lock.lock();
+    _closing = true;
+    for ( auto& [attrs, list] : _parked ) {
+        for ( worker* w : list ) {
+            w->parked = false;
+            w->state.store( worker::quit, std::memory_order_release );
+            futex_wake( w->state, 1 );
+        }
+        list.clear();
+    }
+    _lock.unlock();
+
+    std::uint32_t live;
+    while ( ( live = _live.load( std::memory_order_acquire ) ) != 0 ) {
+        futex_wait( _live, live );
+    }
+}
+
+} // namespace pth
+
+#endif // PTH_CACHE_HXX
@@ -0,0 +1,448 @@
+//
+//
+//  Go style channels for pth threads: bounded, unbounded and rendezvous
+//  pth::channel<T> with close(), and pth::select, which waits for the first
+//  of several sends and receives to go through. Blocked threads sleep on a
+//  futex of their own and are woken by the channels they wait on.
+//
+//
+
+
+#ifndef PTH_CHANNEL_HXX
+#define PTH_CHANNEL_HXX
+
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "pth.hxx"
+
+
+namespace pth {
+
+namespace detail {
+
+struct channel_waiter {
+    void notify() noexcept {
+        signal.fetch_add( 1, std::memory_order_release );
+        futex_wake( signal, 1 );
+    }
+
+    std::atomic<std::uint32_t> signal{ 0 };
+    std::atomic<int> chosen{ -1 };      // index of the case that completed
+};
+
+// A select case waiting on a channel. On a rendezvous channel the other side 
+// completes it: it claims the select by setting w->chosen to index and moves 
+// the value from the sender's T or into the receiver's std::optional<T>.
+struct channel_wait {
+    channel_waiter* w;
+    int index;
+    void* value;
+};
+
+template<class T, class F> class receive_case;
+template<class T, class F> class send_case;
+
+} // namespace detail
+
+
+// A channel with capacity 0 is a rendezvous channel: send() returns once a
+// receiver has taken the value. Otherwise send() waits for space, with the
+// default capacity never. After close() sends fail and receives drain what
+// is left, then return std::nullopt. A stop request ends a blocking call
+// like close() would, without closing the channel.
+//
+// Operations take the channel's hybrid_mutex for a few instructions and
+// only make a syscall to wake threads that sleep on the channel. A select 
+// holds the locks of all its channels while it looks at its cases. Waiters 
+// on a buffered channel are woken on every change and try again. On a 
+// rendezvous channel nothing is buffered: whoever comes second hands the 
+// value over directly to a waiting sender or receiver.
+
+template<class T>
+class channel {
+public:
+    static constexpr std::size_t unbounded = std::size_t(-1);
+    static constexpr std::size_t rendezvous = 0;
+
+    explicit channel( std::size_t capacity = unbounded ) noexcept : _capacity( capacity ) { }
+    ~channel() { assert( _receivers.empty() && _senders.empty() ); }
+
+    channel( const channel& other ) = delete;
+    channel& operator=( const channel& other ) = delete;
+
+    // false if the channel was closed (or stop requested) first
+    bool send( T value, const stop_token& st = stop_token() );
+    template<class U>
+    bool try_send( U&& value );
+
+    std::optional<T> receive( const stop_token& st = stop_token() );
+    std::optional<T> try_receive();
+
+    void close();
+    bool closed() const;
+
+    std::size_t size() const;
+    std::size_t capacity() const noexcept { return _capacity; }
+
+private:
+    template<class U, class F> friend class detail::receive_case;
+    template<class U, class F> friend class detail::send_case;
+
+    using wait_list = std::vector<detail::channel_wait>;
+
+    // Called with _lock held, self is the calling select once it waits here.
+    // true when done: a value was taken, or the channel is closed and empty
+    bool take( std::optional<T>& out, detail::channel_waiter* self );
+    // true when done, sent is false if the channel is closed. value is only 
+    // moved from when it goes out
+    template<class U>
+    bool put( U&& value, bool& sent, detail::channel_waiter* self );
+
+    static detail::channel_wait* claim( wait_list& list, detail::channel_waiter* self ) noexcept;
+    static void delist( wait_list& list, detail::channel_waiter& w );
+    static void notify( wait_list& list ) noexcept { for ( auto& e : list ) e.w->notify(); }
+
+    mutable hybrid_mutex _lock;               // guards everything below
+    std::deque<T> _buffer;
+    wait_list _receivers;                     // waiting for values
+    wait_list _senders;                       // waiting for space (or receivers)
+    const std::size_t _capacity;
+    bool _closed = false;
+};
+
+
+namespace detail {
+
+template<class T, class F>
+class receive_case {
+public:
+    receive_case( channel<T>& ch, F f ) : _ch( ch ), _f( std::move( f ) ) { }
+
+    hybrid_mutex* lock() const noexcept { return &_ch._lock; }
+    bool try_complete( channel_waiter* self ) { return _ch.take( _value, self ); }
+    void enlist( channel_waiter& w, int index ) { _ch._receivers.push_back( { &w, index, &_value } ); }
+    void delist( channel_waiter& w ) { _ch.delist( _ch._receivers, w ); }
+    void claimed() noexcept { }
+    void run() { std::invoke( _f, std::move( _value ) ); }
+
+private:
+    channel<T>& _ch;
+    F _f;
+    std::optional<T> _value;
+};
+
+template<class T, class F>
+class send_case {
+public:
+    template<class U>
+    send_case( channel<T>& ch, U&& value, F f ) : _ch( ch ), _value( std::forward<U>(value) ), _f( std::move( f ) ) { }
+
+    hybrid_mutex* lock() const noexcept { return &_ch._lock; }
+    bool try_complete( channel_waiter* self ) { return _ch.put( std::move( _value ), _sent, self ); }
+    void enlist( channel_waiter& w, int index ) { _ch._senders.push_back( { &w, index, &_value } ); }
+    void delist( channel_waiter& w ) { _ch.delist( _ch._senders, w ); }
+    void claimed() noexcept { _sent = true; }
+    void run() { std::invoke( _f, _sent ); }
+
+private:
+    channel<T>& _ch;
+    T _value;
+    F _f;
+    bool _sent = false;
+};
+
+template<class C>
+inline constexpr bool is_select_case = false;
+
+template<class T, class F>
+inline constexpr bool is_select_case<receive_case<T, F>> = true;
+
+template<class T, class F>
+inline constexpr bool is_select_case<send_case<T, F>> = true;
+
+template<class... Cases>
+concept select_cases = ( is_select_case<std::remove_cvref_t<Cases>> && ... );
+
+// The locks of a select's channels, taken in address order so that selects 
+// sharing channels cannot deadlock. A channel may appear in several cases.
+template<std::size_t N>
+class channel_locks {
+public:
+    explicit channel_locks( std::array<hybrid_mutex*, N> locks ) noexcept : _locks( locks ) {
+        std::sort( _locks.begin(), _locks.end(), std::less<hybrid_mutex*>() );
+        _count = std::size_t( std::unique( _locks.begin(), _locks.end() ) - _locks.begin() );
+    }
+
+    void lock() { for ( std::size_t i = 0; i < _count; i++ ) _locks[i]->lock(); }
+    void unlock() { for ( std::size_t i = _count; i-- > 0; ) _locks[i]->unlock(); }
+
+private:
+    std::array<hybrid_mutex*, N> _locks;
+    std::size_t _count;
+};
+
+// Calls f( std::integral_constant<std::size_t, I>() ) for the case with index i
+template<std::size_t... I, class F>
+inline bool visit_case( std::index_sequence<I...>, std::size_t i, F&& f ) {
+    bool result = false;
+    ( ( i == I && ( result = f( std::integral_constant<std::size_t, I>() ), true ) ) || ... );
+    return result;
+}
+
+// Completes the first ready case from first on, -1 if none is
+template<class Tuple>
+inline int select_once( Tuple& cases, std::size_t first, channel_waiter* self ) {
+    constexpr std::size_t n = std::tuple_size_v<Tuple>;
+    for ( std::size_t k = 0; k < n; k++ ) {
+        const std::size_t i = ( first + k ) % n;
+        if ( visit_case( std::make_index_sequence<n>(), i, [&]( auto I ) { return std::get<I>( cases ).try_complete( self ); } ) )
+            return int( i );
+    }
+    return -1;
+}
+
+template<class Tuple, std::size_t... I>
+inline void enlist_cases( Tuple& cases, channel_waiter& w, std::index_sequence<I...> ) {
+    ( std::get<I>( cases ).enlist( w, int( I ) ), ... );
+}
+
+template<class Tuple>
+inline void claimed_case( Tuple& cases, std::size_t i ) {
+    constexpr std::size_t n = std::tuple_size_v<Tuple>;
+    visit_case( std::make_index_sequence<n>(), i, [&]( auto I ) {
+        std::get<I>( cases ).claimed();
+        return true;
+    } );
+}
+
+template<class Tuple>
+inline void run_case( Tuple& cases, std::size_t i ) {
+    constexpr std::size_t n = std::tuple_size_v<Tuple>;
+    visit_case( std::make_index_sequence<n>(), i, [&]( auto I ) {
+        std::get<I>( cases ).run();
+        return true;
+    } );
+}
+
+} // namespace detail
+
+
+// Select cases: f( std::optional<T> ) gets the value, std::nullopt if ch is
+// closed; f( bool ) learns whether the value went out or ch was closed
+template<class T, class F>
+inline detail::receive_case<T, std::decay_t<F>> on_receive( channel<T>& ch, F&& f ) {
+    return { ch, std::forward<F>(f) };
+}
+
+template<class T, class U, class F>
+inline detail::send_case<T, std::decay_t<F>> on_send( channel<T>& ch, U&& value, F&& f ) {
+    return { ch, std::forward<U>(value), std::forward<F>(f) };
+}
+
+
+// Waits until one of the cases can complete, completes it, runs its
+// handler and returns its index. Ready cases are tried from a varying first
+// one, so none of them starves. -1 if stop was requested before.
+// A send to a rendezvous channel completes only when a receiver takes the 
+// value, and exactly one case completes: the offers of the others are 
+// withdrawn before select returns.
+template<class... Cases>
+    requires detail::select_cases<Cases...>
+int select( const stop_token& st, Cases&&... cases );
+
+template<class... Cases>
+    requires detail::select_cases<Cases...>
+int select( Cases&&... cases ) {
+    return select( stop_token(), std::forward<Cases>(cases)... );
+}
+
+// The same without waiting, -1 if no case is ready
+template<class... Cases>
+    requires detail::select_cases<Cases...>
+int try_select( Cases&&... cases );
+
+
+template<class T>
+inline bool channel<T>::take( std::optional<T>& out, detail::channel_waiter* self ) {
+    if ( !_buffer.empty() ) {
+        out.emplace( std::move( _buffer.front() ) );
+        _buffer.pop_front();
+        notify( _senders );
+        return true;
+    }
+    if ( _closed ) {
+        out.reset();
+        return true;
+    }
+    if ( _capacity != rendezvous ) return false;
+    detail::channel_wait* sender = claim( _senders, self );
+    if ( !sender ) return false;
+    out.emplace( std::move( *static_cast<T*>( sender->value ) ) );
+    return true;
+}
+
+template<class T>
+template<class U>
+inline bool channel<T>::put( U&& value, bool& sent, detail::channel_waiter* self ) {
+    sent = false;
+    if ( _closed ) return true;
+    if ( _capacity == rendezvous ) {
+        detail::channel_wait* receiver = claim( _receivers, self );
+        if ( !receiver ) return false;
+        static_cast<std::optional<T>*>( receiver->value )->emplace( std::forward<U>(value) );
+    }
+    else {
+        if ( _buffer.size() >= _capacity ) return false;
+        _buffer.emplace_back( std::forward<U>(value) );
+        notify( _receivers );
+    }
+    sent = true;
+    return true;
+}
+
+// The first waiting select (not self) that no other case completed yet. 
+// The claim races with other channels of the same select, hence the CAS; 
+// the waiting select itself only looks at chosen while it holds this lock.
+template<class T>
+inline detail::channel_wait* channel<T>::claim( wait_list& list, detail::channel_waiter* self ) noexcept {
+    for ( auto& e : list ) {
+        int open = -1;
+        if ( e.w != self && e.w->chosen.compare_exchange_strong( open, e.index, std::memory_order_acq_rel ) ) {
+            e.w->notify();
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+template<class T>
+inline void channel<T>::delist( wait_list& list, detail::channel_waiter& w ) {
+    list.erase( std::find_if( list.begin(), list.end(), [&w]( const detail::channel_wait& e ) { return e.w == &w; } ) );
+}
+
+template<class T>
+inline bool channel<T>::send( T value, const stop_token& st ) {
+    bool sent = false;
+    select( st, on_send( *this, std::move( value ), [&sent]( bool ok ) { sent = ok; } ) );
+    return sent;
+}
+
+template<class T>
+template<class U>
+inline bool channel<T>::try_send( U&& value ) {
+    bool sent = false;
+    _lock.lock();
+    put( std::forward<U>(value), sent, nullptr );
+    _lock.unlock();
+    return sent;
+}
+
+template<class T>
+inline std::optional<T> channel<T>::receive( const stop_token& st ) {
+    std::optional<T> out;
+    select( st, on_receive( *this, [&out]( std::optional<T> v ) { out = std::move( v ); } ) );
+    return out;
+}
+
+template<class T>
+inline std::optional<T> channel<T>::try_receive() {
+    std::optional<T> out;
+    _lock.lock();
+    take( out, nullptr );
+    _lock.unlock();
+    return out;
+}
+
+// Waiting rendezvous senders still hold their values and fail
+template<class T>
+inline void channel<T>::close() {
+    _lock.lock();
+    if ( !_closed ) {
+        _closed = true;
+        notify( _receivers );
+        notify( _senders );
+    }
+    _lock.unlock();
+}
+
+template<class T>
+inline bool channel<T>::closed() const {
+    _lock.lock();
+    const bool closed = _closed;
+    _lock.unlock();
+    return closed;
+}
+
+template<class T>
+inline std::size_t channel<T>::size() const {
+    _lock.lock();
+    const std::size_t n = _buffer.size();
+    _lock.unlock();
+    return n;
+}
+
+
+template<class... Cases>
+    requires detail::select_cases<Cases...>
+inline int select( const stop_token& st, Cases&&... cases ) {
+    static_assert( sizeof...(Cases) > 0 );
+    auto all = std::forward_as_tuple( cases... );
+    const std::size_t first = std::size_t( cycles() % sizeof...(Cases) );
+    detail::channel_locks<sizeof...(Cases)> locks( { cases.lock()... } );
+
+    locks.lock();
+    int i = detail::select_once( all, first, nullptr );
+    if ( i < 0 ) {
+        detail::channel_waiter w;
+        auto wake = [&w] { w.notify(); };
+        stop_callback<decltype(wake)> on_stop( st, wake );
+        detail::enlist_cases( all, w, std::index_sequence_for<Cases...>() );
+        // every change from here on bumps w.signal, and nothing claims w 
+        // while the locks are held
+        for ( ;; ) {
+            const std::uint32_t seen = w.signal.load( std::memory_order_acquire );
+            if ( st.stop_requested() ) break;
+            locks.unlock();
+            futex_wait( w.signal, seen );
+            locks.lock();
+            if ( ( i = w.chosen.load( std::memory_order_acquire ) ) >= 0 ) {
+                detail::claimed_case( all, std::size_t( i ) );
+                break;
+            }
+            if ( ( i = detail::select_once( all, first, &w ) ) >= 0 ) break;
+        }
+        ( cases.delist( w ), ... );
+    }
+    locks.unlock();
+    if ( i >= 0 ) detail::run_case( all, std::size_t( i ) );
+    return i;
+}
+
+template<class... Cases>
+    requires detail::select_cases<Cases...>
+inline int try_select( Cases&&... cases ) {
+    auto all = std::forward_as_tuple( cases... );
+    detail::channel_locks<sizeof...(Cases)> locks( { cases.lock()... } );
+    locks.lock();
+    const int i = detail::select_once( all, 0, nullptr );
+    locks.unlock();
+    if ( i >= 0 ) detail::run_case( all, std::size_t( i ) );
+    return i;
+}
+
+} // namespace pth
+
+#endif // PTH_CHANNEL_HXX
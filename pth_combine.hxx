@@ -0,0 +1,475 @@
+//
+//
+//  Combining and delegation wrappers for sequential data structures on top 
+//  of pth. Instead of every thread taking the lock and pulling the data's 
+//  cache lines over, operations are handed to the one thread that currently 
+//  owns the data.
+//
+//
+
+
+#ifndef PTH_COMBINE_HXX
+#define PTH_COMBINE_HXX
+
+
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#include "pth.hxx"
+
+
+namespace pth {
+
+namespace detail {
+
+// Small dense per-thread number, used to spread threads over publication slots
+inline std::size_t thread_index() noexcept {
+    static std::atomic<std::size_t> next{ 0 };
+    static thread_local const std::size_t index = next.fetch_add( 1, std::memory_order_relaxed );
+    return index;
+}
+
+} // namespace detail
+
+
+// Flat combining: a thread publishes its operation in a slot and whoever gets 
+// the lock applies all published operations in one batch. Waiters spin for a 
+// while and then park on a futex until the next combiner finishes. 
+// With more than Slots concurrent callers the surplus ones run their operation 
+// directly under the lock.
+
+template<class T, std::size_t Slots = 64>
+class flat_combiner {
+public:
+    template<class... Args>
+    explicit flat_combiner( Args&&... args ) : _data( std::forward<Args>(args)... ) { }
+
+    flat_combiner( const flat_combiner& other ) = delete;
+    flat_combiner& operator=( const flat_combiner& other ) = delete;
+
+    // Runs op(T&) under the combining lock and returns its result, exceptions 
+    // thrown by op are rethrown in the calling thread
+    template<class F>
+    std::invoke_result_t<F&, T&> apply( F&& op );
+
+private:
+
+    static constexpr std::uint64_t spin_budget = 1 << 14;   // cycles() ticks
+    static constexpr int combine_passes = 3;
+
+    struct record {
+        void (*run)( T&, record& );
+        void* op;
+        void* result;
+        std::exception_ptr error;
+        std::atomic<std::uint32_t> done{ 0 };
+    };
+
+    struct alignas(64) slot {
+        std::atomic<record*> rec{ nullptr };
+    };
+
+    bool publish( record& rec ) noexcept;
+    bool trylock() noexcept;
+    void unlock() noexcept;
+    void combine();
+    void park( record& rec ) noexcept;
+
+    alignas(64) std::atomic<bool> _locked{ false };
+    alignas(64) std::atomic<std::uint32_t> _epoch{ 0 };
+    std::atomic<std::uint32_t> _sleepers{ 0 };
+    std::atomic<std::size_t> _span{ 0 };     // slots ever used, only grows
+    std::array<slot, Slots> _slots;
+    alignas(64) T _data;
+};
+
+template<class T, std::size_t Slots>
+inline bool flat_combiner<T, Slots>::publish( record& rec ) noexcept {
+    const std::size_t start = detail::thread_index();
+    for ( std::size_t i = 0; i < Slots; i++ ) {
+        const std::size_t idx = (start + i) % Slots;
+        record* expected = nullptr;
+        if ( _slots[idx].rec.compare_exchange_strong( expected, &rec, std::memory_order_release,
+                                                      std::memory_order_relaxed ) ) {
+            std::size_t span = _span.load( std::memory_order_relaxed );
+            while ( span <= idx && !_span.compare_exchange_weak( span, idx + 1, std::memory_order_relaxed ) ) { }
+            return true;
+        }
+    }
+    return false;
+}
+
+template<class T, std::size_t Slots>
+inline bool flat_combiner<T, Slots>::trylock() noexcept {
+    return !_locked.load( std::memory_order_relaxed ) && 
+           !_locked.exchange( true, std::memory_order_acquire );
+}
+
+template<class T, std::size_t Slots>
+inline void flat_combiner<T, Slots>::unlock() noexcept {
+    _locked.store( false, std::memory_order_seq_cst );
+    _epoch.fetch_add( 1, std::memory_order_seq_cst );
+    if ( _sleepers.load( std::memory_order_seq_cst ) ) {
+        futex_wake( _epoch, INT_MAX );
+    }
+}
+
+template<class T, std::size_t Slots>
+inline void flat_combiner<T, Slots>::combine() {
+    for ( int pass = 0; pass < combine_passes; pass++ ) {
+        bool applied = false;
+        const std::size_t span = _span.load( std::memory_order_relaxed );
+        for ( std::size_t i = 0; i < span; i++ ) {
+            slot& s = _slots[i];
+            record* rec = s.rec.load( std::memory_order_acquire );
+            if ( !rec ) continue;
+            s.rec.store( nullptr, std::memory_order_relaxed );
+            rec->run( _data, *rec );
+            rec->done.store( 1, std::memory_order_release );   // rec may be gone after this
+            applied = true;
+        }
+        if ( !applied ) break;
+    }
+}
+
+template<class T, std::size_t Slots>
+inline void flat_combiner<T, Slots>::park( record& rec ) noexcept {
+    // Either the combiner sees us in _sleepers, or we see its unlock / epoch bump
+    const std::uint32_t epoch = _epoch.load( std::memory_order_seq_cst );
+    _sleepers.fetch_add( 1, std::memory_order_seq_cst );
+    if ( !rec.done.load( std::memory_order_seq_cst ) && _locked.load( std::memory_order_seq_cst ) ) {
+        futex_wait( _epoch, epoch );
+    }
+    _sleepers.fetch_sub( 1, std::memory_order_relaxed );
+}
+
+template<class T, std::size_t Slots>
+template<class F>
+inline std::invoke_result_t<F&, T&> flat_combiner<T, Slots>::apply( F&& op ) {
+    using R = std::invoke_result_t<F&, T&>;
+    using Op = std::remove_reference_t<F>;
+    using Box = detail::result_box<R>;
+
+    Box box;
+    record rec;
+    rec.op = &op;
+    rec.result = &box;
+    rec.run = []( T& data, record& r ) {
+        try {
+            static_cast<Box*>(r.result)->set( *static_cast<Op*>(r.op), data );
+        }
+        catch ( ... ) {
+            r.error = std::current_exception();
+        }
+    };
+
+    if ( trylock() ) {
+        // Nobody combining right now, go first and pick up the others on the way
+        rec.run( _data, rec );
+        combine();
+        unlock();
+    }
+    else if ( !publish( rec ) ) {
+        // All slots taken, run it ourselves as the next combiner
+        while ( !trylock() ) cpu_relax();
+        rec.run( _data, rec );
+        combine();
+        unlock();
+    }
+    else {
+        std::uint64_t start = cycles();
+        while ( !rec.done.load( std::memory_order_acquire ) ) {
+            if ( trylock() ) {
+                combine();
+                unlock();
+            }
+            else if ( cycles() - start < spin_budget ) {
+                cpu_relax();
+            }
+            else {
+                park( rec );
+                start = cycles();
+            }
+        }
+    }
+
+    if ( rec.error ) std::rethrow_exception( rec.error );
+    return box.get();
+}
+
+
+// Delegation: a dedicated server thread, optionally pinned to one cpu, owns 
+// the data so it stays in that core's cache. Clients connect() once and get 
+// their own SPSC request ring to the server. call() waits for the result, 
+// post() returns a pending handle that is waited on later. 
+// Operation records live in the caller's frame or in the pending handle, 
+// nothing is allocated per request. All clients have to be gone before the 
+// delegated object is destroyed.
+
+template<class T, std::size_t Clients = 64, std::size_t Depth = 8>
+class delegated {
+
+    struct request {
+        void (*run)( T&, request& );
+        void* op;
+        void* result;
+        std::exception_ptr error;
+        std::atomic<std::uint32_t> state{ 0 };   // 0 pending, 1 done, 2 waiter parked
+
+        void wait() noexcept;
+        bool ready() const noexcept { return state.load( std::memory_order_acquire ) == 1; }
+    };
+
+    struct alignas(64) channel {
+        std::atomic<bool> claimed{ false };
+        std::size_t head = 0;                                   // client side
+        alignas(64) std::size_t tail = 0;                       // server side
+        std::array<std::atomic<request*>, Depth> ring{};
+    };
+
+    template<class Op>
+    static void bind( request& req, Op& op, detail::result_box<std::invoke_result_t<Op&, T&>>& box ) noexcept;
+
+public:
+
+    template<class Op>
+    class pending {
+    public:
+        using result_type = std::invoke_result_t<Op&, T&>;
+
+        pending( const pending& other ) = delete;
+        pending& operator=( const pending& other ) = delete;
+        ~pending() { _req.wait(); }
+
+        bool ready() const noexcept { return _req.ready(); }
+        void wait() noexcept { _req.wait(); }
+        result_type get();
+
+    private:
+        friend class delegated;
+
+        template<class F>
+        pending( delegated& owner, channel& chan, F&& op ) : _op( std::forward<F>(op) ) { 
+            bind( _req, _op, _box );
+            owner.submit( chan, _req );
+        }
+
+        Op _op;
+        detail::result_box<result_type> _box;
+        request _req;
+    };
+
+    class client {
+    public:
+        client( client&& other ) noexcept 
+            : _owner( std::exchange( other._owner, nullptr ) ), _chan( std::exchange( other._chan, nullptr ) ) { }
+        client( const client& other ) = delete;
+        client& operator=( const client& other ) = delete;
+        ~client() { if ( _chan ) _chan->claimed.store( false, std::memory_order_release ); }
+
+        // Runs op(T&) on the server thread and returns its result
+        template<class F>
+        std::invoke_result_t<F&, T&> call( F&& op );
+
+        // Queues op(T&) on the server thread, the handle waits for it at the latest 
+        // when it is destroyed
+        template<class F>
+        pending<std::decay_t<F>> post( F&& op ) { return pending<std::decay_t<F>>( *_owner, *_chan, std::forward<F>(op) ); }
+
+    private:
+        friend class delegated;
+        client( delegated* owner, channel* chan ) noexcept : _owner( owner ), _chan( chan ) { }
+
+        delegated* _owner;
+        channel* _chan;
+    };
+
+    // Starts the server thread, pinned to cpu unless it is negative
+    template<class... Args>
+    explicit delegated( int cpu, Args&&... args );
+    ~delegated();
+
+    delegated( const delegated& other ) = delete;
+    delegated& operator=( const delegated& other ) = delete;
+
+    client connect() noexcept;
+
+private:
+
+    static constexpr std::uint64_t spin_budget = 1 << 14;        // cycles() ticks, clients
+    static constexpr std::uint64_t idle_budget = 1 << 16;        // server before parking
+
+    static void* serve( void* self );
+    void submit( channel& chan, request& req ) noexcept;
+    bool drain();
+
+    T _data;
+    std::array<channel, Clients> _channels;
+    std::atomic<std::size_t> _span{ 0 };
+    alignas(64) std::atomic<std::uint32_t> _doorbell{ 0 };
+    std::atomic<bool> _parked{ false };
+    std::atomic<bool> _stop{ false };
+    thread _server;
+};
+
+template<class T, std::size_t Clients, std::size_t Depth>
+inline void delegated<T, Clients, Depth>::request::wait() noexcept {
+    const std::uint64_t start = cycles();
+    while ( state.load( std::memory_order_acquire ) == 0 ) {
+        if ( cycles() - start < spin_budget ) { cpu_relax(); continue; }
+        std::uint32_t expected = 0;
+        if ( state.compare_exchange_strong( expected, 2, std::memory_order_acquire ) || expected == 2 ) {
+            while ( state.load( std::memory_order_acquire ) == 2 ) futex_wait( state, 2 );
+        }
+    }
+}
+
+template<class T, std::size_t Clients, std::size_t Depth>
+template<class Op>
+inline void delegated<T, Clients, Depth>::bind( request& req, Op& op, 
+                                                detail::result_box<std::invoke_result_t<Op&, T&>>& box ) noexcept {
+    using Box = detail::result_box<std::invoke_result_t<Op&, T&>>;
+    req.op = &op;
+    req.result = &box;
+    req.run = []( T& data, request& r ) {
+        try {
+            static_cast<Box*>(r.result)->set( *static_cast<Op*>(r.op), data );
+        }
+        catch ( ... ) {
+            r.error = std::current_exception();
+        }
+    };
+}
+
+template<class T, std::size_t Clients, std::size_t Depth>
+template<class Op>
+inline auto delegated<T, Clients, Depth>::pending<Op>::get() -> result_type {
+    _req.wait();
+    if ( _req.error ) std::rethrow_exception( _req.error );
+    return _box.get();
+}
+
+template<class T, std::size_t Clients, std::size_t Depth>
+template<class F>
+inline std::invoke_result_t<F&, T&> delegated<T, Clients, Depth>::client::call( F&& op ) {
+    using Op = std::remove_reference_t<F>;
+    detail::result_box<std::invoke_result_t<F&, T&>> box;
+    request req;
+    bind( req, static_cast<Op&>(op), box );
+    _owner->submit( *_chan, req );
+    req.wait();
+    if ( req.error ) std::rethrow_exception( req.error );
+    return box.get();
+}
+
+template<class T, std::size_t Clients, std::size_t Depth>
+template<class... Args>
+inline delegated<T, Clients, Depth>::delegated( int cpu, Args&&... args ) : _data( std::forward<Args>(args)... ) {
+    ::pthread_attr_t attr;
+    int retval = ::pthread_attr_init( &attr );
+    ASSERT_EQ0( retval );
+    if ( cpu >= 0 ) {
+        ::cpu_set_t set;
+        CPU_ZERO( &set );
+        CPU_SET( cpu, &set );
+        retval = ::pthread_attr_setaffinity_np( &attr, sizeof(set), &set );
+        ASSERT_EQ0( retval );
+    }
+    _server = thread( attr, serve, this );
+    ::pthread_attr_destroy( &attr );
+}
+
+template<class T, std::size_t Clients, std::size_t Depth>
+inline delegated<T, Clients, Depth>::~delegated() {
+    _stop.store( true, std::memory_order_seq_cst );
+    _doorbell.fetch_add( 1, std::memory_order_seq_cst );
+    futex_wake( _doorbell, 1 );
+    _server.join();
+}
+
+template<class T, std::size_t Clients, std::size_t Depth>
+inline auto delegated<T, Clients, Depth>::connect() noexcept -> client {
+    for ( std::size_t i = 0; i < Clients; i++ ) {
+        bool expected = false;
+        if ( _channels[i].claimed.compare_exchange_strong( expected, true, std::memory_order_acquire ) ) {
+            std::size_t span = _span.load( std::memory_order_relaxed );
+            while ( span <= i && !_span.compare_exchange_weak( span, i + 1, std::memory_order_relaxed ) ) { }
+            return client( this, &_channels[i] );
+        }
+    }
+    assert( !"pth::delegated: no free client channel" );
+    return client( this, nullptr );
+}
+
+template<class T, std::size_t Clients, std::size_t Depth>
+inline void delegated<T, Clients, Depth>::submit( channel& chan, request& req ) noexcept {
+    std::atomic<request*>& slot = chan.ring[chan.head % Depth];
+    while ( slot.load( std::memory_order_acquire ) != nullptr ) {
+        cpu_relax();    // ring full, the server is behind
+        if ( _parked.load( std::memory_order_relaxed ) ) ::sched_yield();
+    }
+    chan.head++;
+    slot.store( &req, std::memory_order_seq_cst );
+    if ( _parked.load( std::memory_order_seq_cst ) ) {
+        _doorbell.fetch_add( 1, std::memory_order_release );
+        futex_wake( _doorbell, 1 );
+    }
+}
+
+template<class T, std::size_t Clients, std::size_t Depth>
+inline bool delegated<T, Clients, Depth>::drain() {
+    bool worked = false;
+    const std::size_t span = _span.load( std::memory_order_acquire );
+    for ( std::size_t i = 0; i < span; i++ ) {
+        channel& chan = _channels[i];
+        for ( ;; ) {
+            std::atomic<request*>& slot = chan.ring[chan.tail % Depth];
+            request* req = slot.load( std::memory_order_seq_cst );
+            if ( !req ) break;
+            req->run( _data, *req );
+            slot.store( nullptr, std::memory_order_release );
+            chan.tail++;
+            if ( req->state.exchange( 1, std::memory_order_acq_rel ) == 2 ) {
+                futex_wake( req->state, 1 );    // req may be gone already, waking a stale address is harmless
+            }
+            worked = true;
+        }
+    }
+    return worked;
+}
+
+template<class T, std::size_t Clients, std::size_t Depth>
+inline void* delegated<T, Clients, Depth>::serve( void* self ) {
+    auto& d = *static_cast<delegated*>(self);
+    std::uint64_t idle_since = cycles();
+    for ( ;; ) {
+        if ( d.drain() ) {
+            idle_since = cycles();
+            continue;
+        }
+        if ( d._stop.load( std::memory_order_acquire ) ) break;
+        if ( cycles() - idle_since < idle_budget ) {
+            cpu_relax();
+            continue;
+        }
+        // Clients ring the doorbell only if they see us parked
+        const std::uint32_t bell = d._doorbell.load( std::memory_order_seq_cst );
+        d._parked.store( true, std::memory_order_seq_cst );
+        if ( !d.drain() && !d._stop.load( std::memory_order_seq_cst ) ) {
+            futex_wait( d._doorbell, bell );
+        }
+        d._parked.store( false, std::memory_order_relaxed );
+        idle_since = cycles();
+    }
+    return nullptr;
+}
+
+} // namespace pth
+
+#endif // PTH_COMBINE_HXX
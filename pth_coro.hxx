@@ -0,0 +1,714 @@
+//
+//
+//  C++20 coroutines on pth threads: coro_task<T>, a lazy coroutine that
+//  hands control back to whoever awaits it by symmetric transfer, and
+//  coro_scheduler, which resumes coroutines on its own pth threads and
+//  provides the schedule(), yield() and sleep_for() awaitables. async_mutex,
+//  async_event and async_condition suspend coroutines instead of threads.
+//
+//
+
+
+#ifndef PTH_CORO_HXX
+#define PTH_CORO_HXX
+
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <climits>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "pth.hxx"
+#include "pth_future.hxx"
+#include "pth_pool.hxx"
+
+
+namespace pth {
+
+template<class T = void> class coro_task;
+
+namespace detail {
+
+template<class T>
+class coro_promise_base {
+public:
+    // Resumes the awaiting coroutine directly instead of returning to the
+    // resumer, so chains of awaits neither nest stack frames nor queue up
+    struct final_awaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template<class P>
+        std::coroutine_handle<> await_suspend( std::coroutine_handle<P> h ) noexcept {
+            return h.promise()._continuation;
+        }
+
+        void await_resume() const noexcept { }
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { _error = std::current_exception(); }
+
+    std::coroutine_handle<> _continuation = std::noop_coroutine();
+
+protected:
+    void rethrow() const {
+        if ( _error ) std::rethrow_exception( _error );
+    }
+
+    std::exception_ptr _error;
+};
+
+template<class T>
+class coro_promise : public coro_promise_base<T> {
+public:
+    coro_task<T> get_return_object() noexcept;
+
+    template<class U = T>
+        requires std::is_convertible_v<U&&, T>
+    void return_value( U&& value ) { _result.value.emplace( std::forward<U>(value) ); }
+
+    T result() {
+        this->rethrow();
+        return _result.get();
+    }
+
+private:
+    result_box<T> _result;
+};
+
+template<class T>
+class coro_promise<T&> : public coro_promise_base<T&> {
+public:
+    coro_task<T&> get_return_object() noexcept;
+
+    void return_value( T& value ) noexcept { _result.value = &value; }
+
+    T& result() {
+        this->rethrow();
+        return _result.get();
+    }
+
+private:
+    result_box<T&> _result;
+};
+
+template<>
+class coro_promise<void> : public coro_promise_base<void> {
+public:
+    coro_task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept { }
+
+    void result() { rethrow(); }
+};
+
+// Fire and forget frame for coro_scheduler::spawn(), starts suspended and
+// frees itself when it finishes
+struct coro_detached {
+    struct promise_type {
+        coro_detached get_return_object() noexcept {
+            return { std::coroutine_handle<promise_type>::from_promise( *this ) };
+        }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept { }
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+
+    std::coroutine_handle<> handle;
+};
+
+} // namespace detail
+
+
+// Starts when it is awaited (or spawned) and resumes the awaiting coroutine
+// when it finishes. co_await yields the result or rethrows the exception the
+// coroutine ended with. Destroying a coro_task destroys the coroutine, so it
+// must not be destroyed while the coroutine runs.
+
+template<class T>
+class [[nodiscard]] coro_task {
+public:
+    using promise_type = detail::coro_promise<T>;
+
+    coro_task() noexcept = default;
+    ~coro_task() { if ( _handle ) _handle.destroy(); }
+
+    coro_task( const coro_task& other ) = delete;
+    coro_task& operator=( const coro_task& other ) = delete;
+
+    coro_task( coro_task&& other ) noexcept : _handle( std::exchange( other._handle, nullptr ) ) { }
+
+    coro_task& operator=( coro_task&& other ) noexcept {
+        if ( this != &other ) {
+            if ( _handle ) _handle.destroy();
+            _handle = std::exchange( other._handle, nullptr );
+        }
+        return *this;
+    }
+
+    bool valid() const noexcept { return bool( _handle ); }
+    bool done() const noexcept { return _handle.done(); }
+
+    auto operator co_await() const noexcept {
+        struct awaiter {
+            std::coroutine_handle<promise_type> h;
+
+            bool await_ready() const noexcept { return h.done(); }
+
+            std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) const noexcept {
+                h.promise()._continuation = awaiting;
+                return h;
+            }
+
+            T await_resume() const { return h.promise().result(); }
+        };
+        return awaiter{ _handle };
+    }
+
+private:
+    friend promise_type;
+
+    explicit coro_task( std::coroutine_handle<promise_type> handle ) noexcept : _handle( handle ) { }
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+namespace detail {
+
+template<class T>
+inline coro_task<T> coro_promise<T>::get_return_object() noexcept {
+    return coro_task<T>( std::coroutine_handle<coro_promise>::from_promise( *this ) );
+}
+
+template<class T>
+inline coro_task<T&> coro_promise<T&>::get_return_object() noexcept {
+    return coro_task<T&>( std::coroutine_handle<coro_promise>::from_promise( *this ) );
+}
+
+inline coro_task<void> coro_promise<void>::get_return_object() noexcept {
+    return coro_task<void>( std::coroutine_handle<coro_promise>::from_promise( *this ) );
+}
+
+} // namespace detail
+
+
+// Resumes coroutines on a fixed set of pth threads, oldest first. Idle
+// workers sleep on a futex, with a timeout when coroutines are asleep in
+// sleep_for() / sleep_until().
+//
+// schedule() moves the awaiting coroutine onto a worker (it continues right
+// away if it already runs on one), yield() always goes to the back of the
+// queue. spawn() starts a coro_task on a worker and returns its result as
+// a pth::future. The destructor waits for every spawned coroutine to finish.
+
+class coro_scheduler {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct schedule_awaiter {
+        coro_scheduler& scheduler;
+
+        bool await_ready() const noexcept { return scheduler.worker_index() >= 0; }
+        void await_suspend( std::coroutine_handle<> h ) const { scheduler.post( h ); }
+        void await_resume() const noexcept { }
+    };
+
+    struct yield_awaiter {
+        coro_scheduler& scheduler;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend( std::coroutine_handle<> h ) const { scheduler.post( h ); }
+        void await_resume() const noexcept { }
+    };
+
+    struct sleep_awaiter {
+        coro_scheduler& scheduler;
+        clock::time_point deadline;
+
+        bool await_ready() const noexcept { return deadline <= clock::now(); }
+        void await_suspend( std::coroutine_handle<> h ) const { scheduler.post_at( deadline, h ); }
+        void await_resume() const noexcept { }
+    };
+
+    explicit coro_scheduler( unsigned workers = 0 );
+    coro_scheduler( const ::pthread_attr_t& attrhandle, unsigned workers = 0 );
+    ~coro_scheduler();
+
+    coro_scheduler( const coro_scheduler& other ) = delete;
+    coro_scheduler& operator=( const coro_scheduler& other ) = delete;
+
+    schedule_awaiter schedule() noexcept { return { *this }; }
+    yield_awaiter yield() noexcept { return { *this }; }
+
+    template<class Rep, class Period>
+    sleep_awaiter sleep_for( const std::chrono::duration<Rep, Period>& rel ) noexcept {
+        return { *this, clock::now() + std::chrono::duration_cast<clock::duration>( rel ) };
+    }
+
+    sleep_awaiter sleep_until( clock::time_point deadline ) noexcept { return { *this, deadline }; }
+
+    template<class T>
+    future<T> spawn( coro_task<T> t );
+
+    // Resumes h on one of the workers, now or once deadline has passed
+    void post( std::coroutine_handle<> h );
+    void post_at( clock::time_point deadline, std::coroutine_handle<> h );
+
+    int worker_index() const noexcept {
+        return detail::this_pool_worker.pool == this ? detail::this_pool_worker.index : -1;
+    }
+
+    std::size_t size() const noexcept { return _workers.size(); }
+
+private:
+
+    struct timer {
+        clock::time_point deadline;
+        std::coroutine_handle<> handle;
+
+        bool operator>( const timer& other ) const noexcept { return deadline > other.deadline; }
+    };
+
+    template<class T>
+    static detail::coro_detached drive( coro_scheduler& scheduler, coro_task<T> t, promise<T> p );
+
+    void start( const ::pthread_attr_t* attrhandle, unsigned workers );
+    void signal() noexcept;
+    std::coroutine_handle<> next();
+    static void* work( void* self );
+
+    hybrid_mutex _lock;                                          // guards everything below
+    std::deque<std::coroutine_handle<>> _ready;
+    std::priority_queue<timer, std::vector<timer>, std::greater<timer>> _timers;
+    bool _stopping = false;
+
+    std::atomic<std::uint32_t> _signals{ 0 };
+    std::atomic<std::uint32_t> _idle{ 0 };
+    std::atomic<std::uint32_t> _spawned{ 0 };
+    std::atomic<int> _started{ 0 };
+    std::vector<thread> _workers;
+};
+
+
+inline coro_scheduler::coro_scheduler( unsigned workers ) {
+    start( nullptr, workers );
+}
+
+inline coro_scheduler::coro_scheduler( const ::pthread_attr_t& attrhandle, unsigned workers ) {
+    start( &attrhandle, workers );
+}
+
+inline void coro_scheduler::start( const ::pthread_attr_t* attrhandle, unsigned workers ) {
+    if ( workers == 0 ) {
+        const long cpus = ::sysconf( _SC_NPROCESSORS_ONLN );
+        workers = cpus > 0 ? unsigned( cpus ) : 1;
+    }
+    _workers.reserve( workers );
+    for ( unsigned i = 0; i < workers; i++ ) {
+        if ( attrhandle ) _workers.emplace_back( *attrhandle, work, this );
+        else _workers.emplace_back( work, this );
+    }
+}
+
+inline coro_scheduler::~coro_scheduler() {
+    for ( std::uint32_t n; ( n = _spawned.load( std::memory_order_acquire ) ) != 0; ) futex_wait( _spawned, n );
+
+    _lock.lock();
+    _stopping = true;
+    _lock.unlock();
+    _signals.fetch_add( 1, std::memory_order_seq_cst );
+    futex_wake( _signals, INT_MAX );
+    for ( auto& w : _workers ) w.join();
+}
+
+template<class T>
+inline future<T> coro_scheduler::spawn( coro_task<T> t ) {
+    promise<T> p;
+    future<T> f = p.get_future();
+    _spawned.fetch_add( 1, std::memory_order_relaxed );
+    post( drive( *this, std::move( t ), std::move( p ) ).handle );
+    return f;
+}
+
+template<class T>
+inline detail::coro_detached coro_scheduler::drive( coro_scheduler& scheduler, coro_task<T> t, promise<T> p ) {
+    try {
+        if constexpr ( std::is_void_v<T> ) {
+            co_await t;
+            p.set_value();
+        }
+        else {
+            p.set_value( co_await t );
+        }
+    }
+    catch ( ... ) {
+        p.set_exception( std::current_exception() );
+    }
+    if ( scheduler._spawned.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) futex_wake( scheduler._spawned, INT_MAX );
+}
+
+inline void coro_scheduler::post( std::coroutine_handle<> h ) {
+    _lock.lock();
+    _ready.push_back( h );
+    _lock.unlock();
+    signal();
+}
+
+inline void coro_scheduler::post_at( clock::time_point deadline, std::coroutine_handle<> h ) {
+    _lock.lock();
+    _timers.push( timer{ deadline, h } );
+    _lock.unlock();
+    signal();       // a sleeping worker may have to wake up earlier now
+}
+
+// Either a worker about to sleep sees the new count, or we see it counted
+// as idle
+inline void coro_scheduler::signal() noexcept {
+    _signals.fetch_add( 1, std::memory_order_seq_cst );
+    if ( _idle.load( std::memory_order_seq_cst ) ) futex_wake( _signals, 1 );
+}
+
+// The next coroutine to resume, an empty handle once the scheduler stops.
+// Sleepers whose deadline has passed join the ready queue first.
+inline std::coroutine_handle<> coro_scheduler::next() {
+    for ( ;; ) {
+        const std::uint32_t seen = _signals.load( std::memory_order_seq_cst );
+
+        _lock.lock();
+        clock::duration timeout = clock::duration::max();
+        if ( !_timers.empty() ) {
+            const auto now = clock::now();
+            while ( !_timers.empty() && _timers.top().deadline <= now ) {
+                _ready.push_back( _timers.top().handle );
+                _timers.pop();
+            }
+            if ( !_timers.empty() ) timeout = _timers.top().deadline - now;
+        }
+        if ( !_ready.empty() ) {
+            const std::coroutine_handle<> h = _ready.front();
+            _ready.pop_front();
+            _lock.unlock();
+            return h;
+        }
+        const bool stopping = _stopping;
+        _lock.unlock();
+        if ( stopping ) return nullptr;
+
+        _idle.fetch_add( 1, std::memory_order_seq_cst );
+        if ( timeout == clock::duration::max() ) {
+            futex_wait( _signals, seen );
+        }
+        else {
+            const long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>( timeout ).count();
+            std::timespec reltime{ std::time_t( ns / 1000000000LL ), long( ns % 1000000000LL ) };
+            futex_wait( _signals, seen, &reltime );
+        }
+        _idle.fetch_sub( 1, std::memory_order_relaxed );
+    }
+}
+
+inline void* coro_scheduler::work( void* self ) {
+    auto& scheduler = *static_cast<coro_scheduler*>(self);
+    detail::this_pool_worker = { &scheduler, scheduler._started.fetch_add( 1, std::memory_order_relaxed ) };
+    while ( const std::coroutine_handle<> h = scheduler.next() ) h.resume();
+    return nullptr;
+}
+
+
+namespace detail {
+
+// Intrusive list node, lives in the awaiter inside the suspended coroutine
+struct coro_waiter {
+    std::coroutine_handle<> handle;
+    coro_waiter* next = nullptr;
+};
+
+// Reverses a list pushed LIFO into arrival order
+inline coro_waiter* coro_fifo( coro_waiter* lifo ) noexcept {
+    coro_waiter* fifo = nullptr;
+    while ( lifo ) {
+        coro_waiter* next = lifo->next;
+        lifo->next = fifo;
+        fifo = lifo;
+        lifo = next;
+    }
+    return fifo;
+}
+
+} // namespace detail
+
+
+class async_mutex;
+
+// Owns a locked async_mutex and unlocks it when it goes away
+class async_lock_guard {
+public:
+    async_lock_guard( async_mutex& mutex, std::adopt_lock_t ) noexcept : _mutex( &mutex ) { }
+    ~async_lock_guard();
+
+    async_lock_guard( const async_lock_guard& other ) = delete;
+    async_lock_guard& operator=( const async_lock_guard& other ) = delete;
+
+    async_lock_guard( async_lock_guard&& other ) noexcept : _mutex( std::exchange( other._mutex, nullptr ) ) { }
+
+private:
+    async_mutex* _mutex;
+};
+
+
+// A mutex for coroutines: co_await lock() suspends the coroutine instead of
+// the thread while the mutex is held, co_await scoped_lock() also returns an
+// async_lock_guard. Waiters queue up on a lock-free list and get the mutex in
+// arrival order, unlock() hands it over directly. The new owner is posted to
+// the scheduler if the mutex has one, otherwise it runs inside unlock().
+
+class async_mutex {
+public:
+    struct lock_awaiter : detail::coro_waiter {
+        explicit lock_awaiter( async_mutex& mutex ) noexcept : mutex( mutex ) { }
+
+        bool await_ready() noexcept { return mutex.trylock(); }
+        bool await_suspend( std::coroutine_handle<> h ) noexcept {
+            handle = h;
+            return mutex.enqueue( this );
+        }
+        void await_resume() const noexcept { }
+
+        async_mutex& mutex;
+    };
+
+    struct scoped_lock_awaiter : lock_awaiter {
+        using lock_awaiter::lock_awaiter;
+
+        async_lock_guard await_resume() const noexcept { return async_lock_guard( mutex, std::adopt_lock ); }
+    };
+
+    async_mutex() noexcept = default;
+    explicit async_mutex( coro_scheduler& scheduler ) noexcept : _scheduler( &scheduler ) { }
+    ~async_mutex() { assert( _state.load( std::memory_order_relaxed ) == not_locked ); }
+
+    async_mutex( const async_mutex& other ) = delete;
+    async_mutex& operator=( const async_mutex& other ) = delete;
+
+    lock_awaiter lock() noexcept { return lock_awaiter( *this ); }
+    scoped_lock_awaiter scoped_lock() noexcept { return scoped_lock_awaiter( *this ); }
+
+    bool trylock() noexcept {
+        std::uintptr_t s = not_locked;
+        return _state.compare_exchange_strong( s, locked, std::memory_order_acquire, std::memory_order_relaxed );
+    }
+
+    void unlock();
+
+private:
+    friend class async_condition;
+
+    // _state is not_locked, locked or the latest waiter pushed while locked
+    static constexpr std::uintptr_t not_locked = 1;
+    static constexpr std::uintptr_t locked = 0;
+
+    bool enqueue( detail::coro_waiter* w ) noexcept;
+    void resume( std::coroutine_handle<> h );
+
+    std::atomic<std::uintptr_t> _state{ not_locked };
+    detail::coro_waiter* _waiters = nullptr;      // in order, owned by the holder
+    coro_scheduler* _scheduler = nullptr;
+};
+
+inline async_lock_guard::~async_lock_guard() {
+    if ( _mutex ) _mutex->unlock();
+}
+
+// false if it took the mutex after all
+inline bool async_mutex::enqueue( detail::coro_waiter* w ) noexcept {
+    std::uintptr_t s = _state.load( std::memory_order_relaxed );
+    for ( ;; ) {
+        if ( s == not_locked ) {
+            if ( _state.compare_exchange_weak( s, locked, std::memory_order_acquire, std::memory_order_relaxed ) )
+                return false;
+        }
+        else {
+            w->next = reinterpret_cast<detail::coro_waiter*>( s );
+            if ( _state.compare_exchange_weak( s, reinterpret_cast<std::uintptr_t>( w ),
+                                               std::memory_order_release, std::memory_order_relaxed ) )
+                return true;
+        }
+    }
+}
+
+inline void async_mutex::unlock() {
+    assert( _state.load( std::memory_order_relaxed ) != not_locked );
+    detail::coro_waiter* next = _waiters;
+    if ( !next ) {
+        std::uintptr_t s = locked;
+        if ( _state.compare_exchange_strong( s, not_locked, std::memory_order_release, std::memory_order_relaxed ) )
+            return;
+        s = _state.exchange( locked, std::memory_order_acquire );
+        next = detail::coro_fifo( reinterpret_cast<detail::coro_waiter*>( s ) );
+    }
+    _waiters = next->next;
+    resume( next->handle );
+}
+
+inline void async_mutex::resume( std::coroutine_handle<> h ) {
+    if ( _scheduler ) _scheduler->post( h );
+    else h.resume();
+}
+
+
+// Manual reset event: co_await suspends until set(), which resumes every
+// waiter in arrival order, on the scheduler if the event has one.
+
+class async_event {
+public:
+    struct awaiter : detail::coro_waiter {
+        explicit awaiter( async_event& event ) noexcept : event( event ) { }
+
+        bool await_ready() const noexcept { return event.is_set(); }
+        bool await_suspend( std::coroutine_handle<> h ) noexcept;
+        void await_resume() const noexcept { }
+
+        async_event& event;
+    };
+
+    explicit async_event( bool set = false ) noexcept : _state( set ? set_state : 0 ) { }
+    explicit async_event( coro_scheduler& scheduler, bool set = false ) noexcept
+        : _state( set ? set_state : 0 ), _scheduler( &scheduler ) { }
+
+    async_event( const async_event& other ) = delete;
+    async_event& operator=( const async_event& other ) = delete;
+
+    awaiter operator co_await() noexcept { return awaiter( *this ); }
+
+    void set();
+    void reset() noexcept {
+        std::uintptr_t s = set_state;
+        _state.compare_exchange_strong( s, 0, std::memory_order_relaxed );
+    }
+    bool is_set() const noexcept { return _state.load( std::memory_order_acquire ) == set_state; }
+
+private:
+
+    // _state is set_state, 0 or the latest waiter
+    static constexpr std::uintptr_t set_state = 1;
+
+    std::atomic<std::uintptr_t> _state;
+    coro_scheduler* _scheduler = nullptr;
+};
+
+inline bool async_event::awaiter::await_suspend( std::coroutine_handle<> h ) noexcept {
+    handle = h;
+    std::uintptr_t s = event._state.load( std::memory_order_acquire );
+    do {
+        if ( s == set_state ) return false;
+        next = reinterpret_cast<detail::coro_waiter*>( s );
+    } while ( !event._state.compare_exchange_weak( s, reinterpret_cast<std::uintptr_t>( this ),
+                                                   std::memory_order_release, std::memory_order_acquire ) );
+    return true;
+}
+
+inline void async_event::set() {
+    const std::uintptr_t s = _state.exchange( set_state, std::memory_order_acq_rel );
+    if ( s == set_state ) return;
+    for ( auto* w = detail::coro_fifo( reinterpret_cast<detail::coro_waiter*>( s ) ); w; ) {
+        // the waiter is gone once it runs
+        const std::coroutine_handle<> h = w->handle;
+        w = w->next;
+        if ( _scheduler ) _scheduler->post( h );
+        else h.resume();
+    }
+}
+
+
+// Condition variable for coroutines holding an async_mutex. co_await
+// wait( mutex ) releases the mutex and suspends until a notify, notified
+// waiters queue up for the mutex again instead of all waking up at once, so
+// the wait returns with the mutex held. Spurious wakeups do not happen, but
+// the predicate may be false again by the time the mutex is back.
+
+class async_condition {
+public:
+    struct wait_awaiter : detail::coro_waiter {
+        wait_awaiter( async_condition& cond, async_mutex& mutex ) noexcept : cond( cond ), mutex( mutex ) { }
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend( std::coroutine_handle<> h );
+        void await_resume() const noexcept { }
+
+        async_condition& cond;
+        async_mutex& mutex;
+    };
+
+    async_condition() = default;
+
+    async_condition( const async_condition& other ) = delete;
+    async_condition& operator=( const async_condition& other ) = delete;
+
+    wait_awaiter wait( async_mutex& mutex ) noexcept { return wait_awaiter( *this, mutex ); }
+
+    void notify_one();
+    void notify_all();
+
+private:
+
+    static void requeue( wait_awaiter* w );
+
+    ttas_spinlock<> _lock;                    // guards the list
+    wait_awaiter* _head = nullptr;
+    wait_awaiter* _tail = nullptr;
+};
+
+inline void async_condition::wait_awaiter::await_suspend( std::coroutine_handle<> h ) {
+    handle = h;
+    next = nullptr;
+    async_mutex& m = mutex;     // a notify may resume us before unlock() returns
+    cond._lock.lock();
+    if ( cond._tail ) cond._tail->next = this;
+    else cond._head = this;
+    cond._tail = this;
+    cond._lock.unlock();
+    m.unlock();
+}
+
+inline void async_condition::requeue( wait_awaiter* w ) {
+    if ( !w->mutex.enqueue( w ) ) w->mutex.resume( w->handle );
+}
+
+inline void async_condition::notify_one() {
+    _lock.lock();
+    wait_awaiter* w = _head;
+    if ( w ) {
+        _head = static_cast<wait_awaiter*>( w->next );
+        if ( !_head ) _tail = nullptr;
+    }
+    _lock.unlock();
+    if ( w ) requeue( w );
+}
+
+inline void async_condition::notify_all() {
+    _lock.lock();
+    wait_awaiter* w = std::exchange( _head, nullptr );
+    _tail = nullptr;
+    _lock.unlock();
+    while ( w ) {
+        wait_awaiter* next = static_cast<wait_awaiter*>( w->next );
+        requeue( w );
+        w = next;
+    }
+}
+
+} // namespace pth
+
+#endif // PTH_CORO_HXX
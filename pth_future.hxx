@@ -0,0 +1,345 @@
+//
+//
+//  Typed results for pth threads: a promise / future pair with a single 
+//  allocation for the shared state, and pth::async which launches a 
+//  callable on its own pth::thread or on a thread pool.
+//
+//
+
+
+#ifndef PTH_FUTURE_HXX
+#define PTH_FUTURE_HXX
+
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "pth.hxx"
+
+
+namespace pth {
+
+template<class T> class future;
+template<class T> class promise;
+
+namespace detail {
+
+// Shared between exactly one producer and one future. The last of the two to 
+// let go destroys it through _destroy, so derived states (pth::async keeps the 
+// callable in there) are freed in one piece.
+template<class T>
+class shared_state {
+public:
+    explicit shared_state( void (*destroy)( shared_state* ) ) noexcept : _destroy( destroy ) { }
+
+    shared_state( const shared_state& other ) = delete;
+    shared_state& operator=( const shared_state& other ) = delete;
+
+    template<class F, class... Args>
+    void run( F& f, Args&&... args ) noexcept;
+    void set_exception( std::exception_ptr error ) noexcept;
+
+    bool ready() const noexcept { return _state.load( std::memory_order_acquire ) == ready_state; }
+    void wait() noexcept;
+    bool wait_for( std::chrono::nanoseconds rel ) noexcept;
+    T get();
+
+    void release() noexcept { if ( _refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) _destroy( this ); }
+
+    thread worker;     // set by pth::async, joined by the future
+
+private:
+
+    static constexpr std::uint32_t empty_state = 0;
+    static constexpr std::uint32_t ready_state = 1;
+    static constexpr std::uint32_t waited_state = 2;
+
+    void publish() noexcept;
+    bool park( const std::timespec* reltime ) noexcept;
+
+    std::atomic<std::uint32_t> _state{ empty_state };
+    std::atomic<std::uint32_t> _refs{ 2 };
+    void (*_destroy)( shared_state* );
+    result_box<T> _result;
+    std::exception_ptr _error;
+};
+
+template<class T>
+template<class F, class... Args>
+inline void shared_state<T>::run( F& f, Args&&... args ) noexcept {
+    try {
+        _result.set( f, std::forward<Args>(args)... );
+    }
+    catch ( ... ) {
+        _error = std::current_exception();
+    }
+    publish();
+}
+
+template<class T>
+inline void shared_state<T>::set_exception( std::exception_ptr error ) noexcept {
+    _error = std::move( error );
+    publish();
+}
+
+template<class T>
+inline void shared_state<T>::publish() noexcept {
+    if ( _state.exchange( ready_state, std::memory_order_acq_rel ) == waited_state ) {
+        futex_wake( _state, INT_MAX );
+    }
+}
+
+template<class T>
+inline bool shared_state<T>::park( const std::timespec* reltime ) noexcept {
+    std::uint32_t s = empty_state;
+    if ( !_state.compare_exchange_strong( s, waited_state, std::memory_order_acquire ) && s == ready_state ) 
+        return true;
+    return futex_wait( _state, waited_state, reltime ) != ETIMEDOUT;
+}
+
+template<class T>
+inline void shared_state<T>::wait() noexcept {
+    while ( !ready() ) park( nullptr );
+}
+
+template<class T>
+inline bool shared_state<T>::wait_for( std::chrono::nanoseconds rel ) noexcept {
+    const auto deadline = std::chrono::steady_clock::now() + rel;
+    while ( !ready() ) {
+        const auto left = deadline - std::chrono::steady_clock::now();
+        if ( left <= std::chrono::nanoseconds::zero() ) return false;
+        const long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>( left ).count();
+        std::timespec reltime{ std::time_t( ns / 1000000000LL ), long( ns % 1000000000LL ) };
+        park( &reltime );
+    }
+    return true;
+}
+
+template<class T>
+inline T shared_state<T>::get() {
+    wait();
+    if ( _error ) std::rethrow_exception( _error );
+    return _result.get();
+}
+
+template<class T>
+inline void delete_state( shared_state<T>* state ) { delete state; }
+
+template<class T>
+future<T> make_future( shared_state<T>* state ) noexcept;
+
+template<class R, class F, class... Args>
+struct async_state : shared_state<R> {
+    template<class G, class... A>
+    explicit async_state( G&& g, A&&... a ) 
+        : shared_state<R>( destroy ), fn( std::forward<G>(g) ), args( std::forward<A>(a)... ) { }
+
+    static void destroy( shared_state<R>* state ) { delete static_cast<async_state*>(state); }
+
+    static void* start( void* self ) {
+        auto* state = static_cast<async_state*>(self);
+        std::apply( [state]( auto&... a ) { state->run( state->fn, std::move( a )... ); }, state->args );
+        state->release();
+        return nullptr;
+    }
+
+    F fn;
+    std::tuple<Args...> args;
+};
+
+} // namespace detail
+
+
+template<class T>
+class future {
+public:
+    future() noexcept = default;
+    ~future() { reset(); }
+
+    future( const future& other ) = delete;
+    future& operator=( const future& other ) = delete;
+
+    future( future&& other ) noexcept : _state( std::exchange( other._state, nullptr ) ) { }
+
+    future& operator=( future&& other ) noexcept {
+        if ( this != &other ) {
+            reset();
+            _state = std::exchange( other._state, nullptr );
+        }
+        return *this;
+    }
+
+    bool valid() const noexcept { return _state != nullptr; }
+    bool ready() const noexcept { return _state->ready(); }
+
+    // Waits for the result and gives up the shared state, exceptions of the 
+    // producer are rethrown
+    T get();
+
+    void wait() const noexcept { _state->wait(); }
+
+    template<class Rep, class Period>
+    std::future_status wait_for( const std::chrono::duration<Rep, Period>& rel ) const noexcept {
+        return _state->wait_for( std::chrono::duration_cast<std::chrono::nanoseconds>( rel ) ) 
+            ? std::future_status::ready : std::future_status::timeout;
+    }
+
+    template<class Clock, class Duration>
+    std::future_status wait_until( const std::chrono::time_point<Clock, Duration>& abs ) const noexcept {
+        return wait_for( abs - Clock::now() );
+    }
+
+private:
+    friend class promise<T>;
+
+    template<class U>
+    friend future<U> detail::make_future( detail::shared_state<U>* state ) noexcept;
+
+    explicit future( detail::shared_state<T>* state ) noexcept : _state( state ) { }
+
+    void reset() noexcept;
+
+    detail::shared_state<T>* _state = nullptr;
+};
+
+namespace detail {
+
+template<class T>
+inline future<T> make_future( shared_state<T>* state ) noexcept { return future<T>( state ); }
+
+} // namespace detail
+
+template<class T>
+inline void future<T>::reset() noexcept {
+    if ( !_state ) return;
+    _state->worker.join();
+    std::exchange( _state, nullptr )->release();
+}
+
+template<class T>
+inline T future<T>::get() {
+    struct releaser {
+        future* self;
+        ~releaser() { self->reset(); }
+    } guard{ this };
+    return _state->get();
+}
+
+
+// Producer side for results computed elsewhere, e.g. by a thread pool. 
+// set_value() captures exceptions thrown while constructing the value into the 
+// future. A promise destroyed without a result leaves 
+// std::future_errc::broken_promise in the future.
+
+template<class T>
+class promise {
+public:
+    promise() : _state( new detail::shared_state<T>( detail::delete_state<T> ) ) { }
+    ~promise();
+
+    promise( const promise& other ) = delete;
+    promise& operator=( const promise& other ) = delete;
+
+    promise( promise&& other ) noexcept 
+        : _state( std::exchange( other._state, nullptr ) ), _retrieved( other._retrieved ), 
+          _satisfied( other._satisfied ) { }
+
+    // Only once per promise
+    future<T> get_future() noexcept { 
+        assert( !_retrieved );
+        _retrieved = true;
+        return detail::make_future( _state ); 
+    }
+
+    template<class... V>
+    void set_value( V&&... value ) noexcept;
+    void set_exception( std::exception_ptr error ) noexcept;
+
+private:
+
+    detail::shared_state<T>* _state;
+    bool _retrieved = false;
+    bool _satisfied = false;
+};
+
+template<class T>
+inline promise<T>::~promise() {
+    if ( !_state ) return;
+    if ( !_satisfied ) {
+        _state->set_exception( std::make_exception_ptr( std::future_error( std::future_errc::broken_promise ) ) );
+    }
+    if ( !_retrieved ) _state->release();   // the future's share
+    _state->release();
+}
+
+template<class T>
+template<class... V>
+inline void promise<T>::set_value( V&&... value ) noexcept {
+    auto identity = []( auto&&... v ) -> T { return T( std::forward<decltype(v)>(v)... ); };
+    _state->run( identity, std::forward<V>(value)... );
+    _satisfied = true;
+}
+
+template<class T>
+inline void promise<T>::set_exception( std::exception_ptr error ) noexcept {
+    _state->set_exception( std::move( error ) );
+    _satisfied = true;
+}
+
+
+// Runs f(args...) on a new pth::thread created with attr. The callable, its 
+// arguments and the result share one allocation. The future joins the thread 
+// when it goes away, so attr has to describe a joinable thread.
+
+template<class F, class... Args>
+auto async( const ::pthread_attr_t& attr, F&& f, Args&&... args )
+    -> future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+
+    using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+    using State = detail::async_state<R, std::decay_t<F>, std::decay_t<Args>...>;
+
+    auto* state = new State( std::forward<F>(f), std::forward<Args>(args)... );
+    state->worker = thread( attr, State::start, state );
+    return detail::make_future<R>( state );
+}
+
+template<class F, class... Args>
+    requires std::is_invocable_v<std::decay_t<F>, std::decay_t<Args>...>
+auto async( F&& f, Args&&... args ) -> future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+    ::pthread_attr_t attr;
+    int retval = ::pthread_attr_init( &attr );
+    ASSERT_EQ0( retval );
+    auto fut = async( attr, std::forward<F>(f), std::forward<Args>(args)... );
+    ::pthread_attr_destroy( &attr );
+    return fut;
+}
+
+
+// Runs f(args...) as a task of a pool with a submit( callable ) member, 
+// e.g. pth::fixed_pool. The pool only stores a pointer to the shared state, 
+// so it fits any inline task buffer.
+
+template<class Pool, class F, class... Args>
+    requires requires( Pool& pool ) { pool.submit( [] { } ); }
+auto async( Pool& pool, F&& f, Args&&... args ) 
+    -> future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+
+    using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+    using State = detail::async_state<R, std::decay_t<F>, std::decay_t<Args>...>;
+
+    auto* state = new State( std::forward<F>(f), std::forward<Args>(args)... );
+    pool.submit( [state] { State::start( state ); } );
+    return detail::make_future<R>( state );
+}
+
+} // namespace pth
+
+#endif // PTH_FUTURE_HXX
@@ -0,0 +1,179 @@
+//
+//
+//  Dependency graphs of tasks for pth pools. Nodes become ready through
+//  atomic dependency counters and are dispatched to the pool as soon as
+//  their last predecessor finishes, without locks. A graph can be run again
+//  and again; a run only resets the counters.
+//
+//
+
+
+#ifndef PTH_GRAPH_HXX
+#define PTH_GRAPH_HXX
+
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "pth.hxx"
+
+
+namespace pth {
+
+// Nodes are added with emplace() and ordered with precede(), both only
+// while the graph is not running. run() returns when every node has run,
+// a node that throws cancels the nodes not started yet and run() rethrows
+// its exception. Of the nodes a finished node makes ready, one continues
+// on the same thread and the others are submitted to the pool, or run
+// right away if its ring is full. A run from inside a pool task helps with
+// queued tasks while it waits.
+
+class task_graph {
+public:
+    using node = std::size_t;
+
+    task_graph() = default;
+
+    task_graph( const task_graph& other ) = delete;
+    task_graph& operator=( const task_graph& other ) = delete;
+
+    template<class F>
+    node emplace( F&& f ) {
+        _nodes.emplace_back( task( std::forward<F>(f) ) );
+        _checked = false;
+        return _nodes.size() - 1;
+    }
+
+    // after runs only once before has finished
+    void precede( node before, node after ) {
+        assert( before < _nodes.size() && after < _nodes.size() && before != after );
+        _nodes[before].successors.push_back( after );
+        _nodes[after].dependencies++;
+        _checked = false;
+    }
+
+    template<class Pool>
+    void run( Pool& pool );
+
+    bool acyclic() const;
+
+    std::size_t size() const noexcept { return _nodes.size(); }
+    bool empty() const noexcept { return _nodes.empty(); }
+
+    void clear() noexcept { _nodes.clear(); }
+
+private:
+
+    struct node_data {
+        explicit node_data( task&& t ) noexcept : fn( std::move( t ) ) { }
+
+        task fn;
+        std::vector<node> successors;
+        std::uint32_t dependencies = 0;
+        std::atomic<std::uint32_t> waiting{ 0 };
+    };
+
+    template<class Pool>
+    void dispatch( Pool& pool, node n ) noexcept;
+    template<class Pool>
+    void execute( Pool& pool, node n ) noexcept;
+
+    std::deque<node_data> _nodes;
+    std::atomic<std::uint32_t> _pending{ 0 };
+    std::atomic<bool> _failed{ false };
+    std::exception_ptr _error;
+    bool _checked = false;
+};
+
+
+template<class Pool>
+inline void task_graph::run( Pool& pool ) {
+#ifndef NDEBUG
+    if ( !_checked ) {
+        assert( acyclic() );
+        _checked = true;
+    }
+#endif
+    if ( _nodes.empty() ) return;
+
+    for ( auto& n : _nodes ) n.waiting.store( n.dependencies, std::memory_order_relaxed );
+    _failed.store( false, std::memory_order_relaxed );
+    _error = nullptr;
+    _pending.store( std::uint32_t( _nodes.size() ), std::memory_order_release );
+
+    for ( node n = 0; n < _nodes.size(); n++ ) {
+        if ( _nodes[n].dependencies == 0 ) dispatch( pool, n );
+    }
+
+    const bool helper = pool.worker_index() >= 0;
+    for ( ;; ) {
+        const std::uint32_t left = _pending.load( std::memory_order_acquire );
+        if ( left == 0 ) break;
+        if ( helper && pool.run_pending() ) continue;
+        futex_wait( _pending, left );
+    }
+    if ( _error ) std::rethrow_exception( std::exchange( _error, nullptr ) );
+}
+
+// Runs the node right here when the pool's ring is full, a worker blocked in
+// submit() might wait for cells held by other blocked workers
+template<class Pool>
+inline void task_graph::dispatch( Pool& pool, node n ) noexcept {
+    if ( !pool.try_submit( [this, &pool, n] { execute( pool, n ); } ).valid() ) execute( pool, n );
+}
+
+template<class Pool>
+inline void task_graph::execute( Pool& pool, node n ) noexcept {
+    while ( n != node(-1) ) {
+        node_data& current = _nodes[n];
+        if ( !_failed.load( std::memory_order_relaxed ) ) {
+            try {
+                current.fn();
+            }
+            catch ( ... ) {
+                if ( !_failed.exchange( true ) ) _error = std::current_exception();
+            }
+        }
+
+        node next = node(-1);
+        for ( node s : current.successors ) {
+            if ( _nodes[s].waiting.fetch_sub( 1, std::memory_order_acq_rel ) != 1 ) continue;
+            if ( next == node(-1) ) next = s;
+            else dispatch( pool, s );
+        }
+
+        if ( _pending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) futex_wake( _pending, INT_MAX );
+        n = next;
+    }
+}
+
+// Kahn's algorithm on a copy of the counters
+inline bool task_graph::acyclic() const {
+    std::vector<std::uint32_t> waiting( _nodes.size() );
+    std::vector<node> ready;
+    for ( node n = 0; n < _nodes.size(); n++ ) {
+        waiting[n] = _nodes[n].dependencies;
+        if ( waiting[n] == 0 ) ready.push_back( n );
+    }
+    std::size_t done = 0;
+    while ( !ready.empty() ) {
+        const node n = ready.back();
+        ready.pop_back();
+        done++;
+        for ( node s : _nodes[n].successors ) {
+            if ( --waiting[s] == 0 ) ready.push_back( s );
+        }
+    }
+    return done == _nodes.size();
+}
+
+} // namespace pth
+
+#endif // PTH_GRAPH_HXX
@@ -0,0 +1,146 @@
+//
+//
+//  Structured fork-join for pth pools: a task_group spawns tasks onto a
+//  pool and wait() joins them. On the pool's own workers it helps to run
+//  queued pool tasks instead of blocking.
+//
+//
+
+
+#ifndef PTH_GROUP_HXX
+#define PTH_GROUP_HXX
+
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#include <sched.h>
+
+#include "pth.hxx"
+#include "pth_pool.hxx"
+
+
+namespace pth {
+
+// Tasks are f() or f( stop_token ). When the pool's ring is full, run() on
+// one of the pool's workers runs the task right there instead of blocking:
+// tasks waiting in nested groups keep their ring cells, and with all of them
+// taken a blocking submit would never return. Other threads retry until a
+// cell is free rather than submit(), which would hold up every task queued
+// after the position it reserves. They also wait without running pool
+// tasks, like parallel_for. Callables the pool cannot store inline go to
+// the heap in a basic_task.
+//
+// The first exception cancels the group and is rethrown by wait(); cancel()
+// does the same without an error. Tasks of a cancelled group that have not
+// started yet are skipped, running ones see it through their stop_token.
+// After wait() the group can be used again. The destructor waits too, but
+// drops a pending exception.
+
+template<class Pool>
+class basic_task_group {
+public:
+    explicit basic_task_group( Pool& pool ) noexcept : _pool( pool ) { }
+    ~basic_task_group() { join(); }
+
+    basic_task_group( const basic_task_group& other ) = delete;
+    basic_task_group& operator=( const basic_task_group& other ) = delete;
+
+    template<class F>
+    void run( F&& f );
+
+    void wait();
+
+    void cancel() noexcept { _stop.request_stop(); }
+    bool cancelled() const noexcept { return _stop.stop_requested(); }
+    stop_token get_stop_token() const noexcept { return _stop.get_token(); }
+
+private:
+
+    template<class T>
+    void post( T& t );
+    template<class F>
+    void execute( F& f ) noexcept;
+    void join() noexcept;
+
+    Pool& _pool;
+    stop_source _stop;
+    std::atomic<std::uint32_t> _pending{ 0 };
+    std::atomic<bool> _failed{ false };
+    std::exception_ptr _error;
+};
+
+using task_group = basic_task_group<fixed_pool>;
+
+
+template<class Pool>
+template<class F>
+inline void basic_task_group<Pool>::run( F&& f ) {
+    using Task = basic_task<Pool::inline_size>;
+
+    _pending.fetch_add( 1, std::memory_order_relaxed );
+    auto runner = [group = this, fn = std::forward<F>(f)]() mutable { group->execute( fn ); };
+    if constexpr ( Task::template stored_inline<decltype(runner)> ) {
+        post( runner );
+    }
+    else {
+        Task t( std::move( runner ) );
+        post( t );
+    }
+}
+
+template<class Pool>
+template<class T>
+inline void basic_task_group<Pool>::post( T& t ) {
+    const bool worker = _pool.worker_index() >= 0;
+    while ( !_pool.try_submit( std::move( t ) ).valid() ) {
+        if ( worker ) {
+            t();
+            return;
+        }
+        ::sched_yield();
+    }
+}
+
+template<class Pool>
+template<class F>
+inline void basic_task_group<Pool>::execute( F& f ) noexcept {
+    if ( !_stop.stop_requested() ) {
+        try {
+            if constexpr ( std::is_invocable_v<F&, stop_token> ) f( _stop.get_token() );
+            else f();
+        }
+        catch ( ... ) {
+            if ( !_failed.exchange( true ) ) _error = std::current_exception();
+            _stop.request_stop();
+        }
+    }
+    if ( _pending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) futex_wake( _pending, INT_MAX );
+}
+
+template<class Pool>
+inline void basic_task_group<Pool>::join() noexcept {
+    const bool helper = _pool.worker_index() >= 0;
+    for ( ;; ) {
+        const std::uint32_t left = _pending.load( std::memory_order_acquire );
+        if ( left == 0 ) break;
+        if ( helper && _pool.run_pending() ) continue;
+        futex_wait( _pending, left );
+    }
+    if ( _stop.stop_requested() ) _stop = stop_source();
+    _failed.store( false, std::memory_order_relaxed );
+}
+
+template<class Pool>
+inline void basic_task_group<Pool>::wait() {
+    join();
+    if ( _error ) std::rethrow_exception( std::exchange( _error, nullptr ) );
+}
+
+} // namespace pth
+
+#endif // PTH_GROUP_HXX
@@ -0,0 +1,329 @@
+//
+//  cyclictest style wakeup latency harness for pth threads.
+//
+//  Every measuring thread wakes up periodically and records how late it 
+//  was into a 1us histogram:
+//    sleep    clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME ) against the 
+//             programmed deadline
+//    hybrid   pth::this_thread::sleep_until in hybrid mode, the same way
+//    futex    woken through pth::futex_wake by a paired pacing thread, 
+//             against the time stamped right before the wake
+//    condvar  the same through pth::cond_var::signal
+//  In futex and condvar mode a late wake is measured against the period the 
+//  thread waited for, pacing periods it slept through meanwhile show up as 
+//  M (missed) instead of as samples.
+//
+//  usage: pth_latency [-t threads] [-i interval_us] [-l loops] [-p rt_prio] 
+//                     [-a] [-m] [-w sleep|hybrid|futex|condvar] [-H]
+//    -p  SCHED_FIFO priority for measuring (and pacing) threads
+//    -a  pin thread n to cpu n % cpus
+//    -m  mlockall( MCL_CURRENT | MCL_FUTURE )
+//    -H  print the histograms too
+//
+
+
+#include "pth.hxx"
+#include "pth_rt.hxx"
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <iostream>
+#include <iomanip>
+#include <array>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <ctime>
+
+
+
+namespace {
+
+constexpr int buckets = 10000;       // 1us each, everything above lands in the last one
+
+enum class wake_mode { sleep, hybrid, futex, condvar };
+
+struct options {
+    int threads = 1;
+    long interval_us = 1000;
+    long loops = 10000;
+    int priority = 0;
+    bool pin = false;
+    bool lock_memory = false;
+    bool histogram = false;
+    wake_mode mode = wake_mode::sleep;
+};
+
+std::int64_t now_ns() {
+    std::timespec ts;
+    ::clock_gettime( CLOCK_MONOTONIC, &ts );
+    return std::int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+void sleep_until_ns( std::int64_t deadline ) {
+    std::timespec ts{ std::time_t( deadline / 1000000000LL ), long( deadline % 1000000000LL ) };
+    while ( ::clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr ) == EINTR ) { }
+}
+
+
+struct measurement {
+    const options* opts;
+    int index;
+
+    std::vector<std::uint64_t> histogram = std::vector<std::uint64_t>( buckets );
+    std::int64_t min = INT64_MAX;
+    std::int64_t max = 0;
+    std::int64_t sum = 0;
+    long count = 0;
+    long missed = 0;
+    ::pid_t tid = 0;
+
+    // futex / condvar handshake with the pacing thread, which stamps period 
+    // n into stamps[n % stamp_ring] before it publishes seq = n
+    static constexpr std::uint32_t stamp_ring = 64;
+    std::atomic<std::uint32_t> seq{ 0 };
+    std::array<std::atomic<std::int64_t>, stamp_ring> stamps{};
+    std::atomic<bool> done{ false };
+    pth::mutex mtx;
+    pth::cond_var cv;
+
+    void record( std::int64_t latency_ns ) {
+        if ( latency_ns < 0 ) latency_ns = 0;
+        std::int64_t us = latency_ns / 1000;
+        histogram[us < buckets ? us : buckets - 1]++;
+        if ( latency_ns < min ) min = latency_ns;
+        if ( latency_ns > max ) max = latency_ns;
+        sum += latency_ns;
+        count++;
+    }
+
+    // The thread waited for period seen + 1 and found the pacer at current: 
+    // the sample is taken against the first period, later ones it slept 
+    // through are counted as missed, not as (near zero) samples
+    void woken( std::uint32_t seen, std::uint32_t current, std::int64_t now ) {
+        const std::uint32_t lag = current - seen;
+        std::int64_t stamp;
+        if ( lag <= stamp_ring / 2 ) stamp = stamps[( seen + 1 ) % stamp_ring].load( std::memory_order_relaxed );
+        else stamp = stamps[current % stamp_ring].load( std::memory_order_relaxed ) - std::int64_t( lag - 1 ) * opts->interval_us * 1000;
+        record( now - stamp );
+        missed += lag - 1;
+    }
+
+    // Smallest latency in us with at least fraction of the samples at or below it
+    long percentile( double fraction ) const {
+        const std::uint64_t wanted = std::uint64_t( fraction * double(count) + 0.5 );
+        std::uint64_t seen = 0;
+        for ( int us = 0; us < buckets; us++ ) {
+            seen += histogram[us];
+            if ( seen >= wanted && seen ) return us;
+        }
+        return buckets - 1;
+    }
+};
+
+
+void* measure_sleep( void* p ) {
+    auto& m = *static_cast<measurement*>(p);
+    m.tid = pth::this_thread::tid();
+    const std::int64_t interval = m.opts->interval_us * 1000;
+    std::int64_t next = now_ns() + interval;
+    for ( long i = 0; i < m.opts->loops; i++ ) {
+        sleep_until_ns( next );
+        m.record( now_ns() - next );
+        next += interval;
+    }
+    return nullptr;
+}
+
+void* measure_hybrid( void* p ) {
+    auto& m = *static_cast<measurement*>(p);
+    m.tid = pth::this_thread::tid();
+    const auto interval = std::chrono::microseconds( m.opts->interval_us );
+    auto next = std::chrono::steady_clock::now() + interval;
+    for ( long i = 0; i < m.opts->loops; i++ ) {
+        pth::this_thread::sleep_until( next );
+        m.record( std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - next ).count() );
+        next += interval;
+    }
+    return nullptr;
+}
+
+void* measure_futex( void* p ) {
+    auto& m = *static_cast<measurement*>(p);
+    m.tid = pth::this_thread::tid();
+    std::uint32_t seen = 0;
+    for ( long i = 0; i < m.opts->loops; i++ ) {
+        std::uint32_t current;
+        while ( ( current = m.seq.load( std::memory_order_acquire ) ) == seen ) pth::futex_wait( m.seq, seen );
+        m.woken( seen, current, now_ns() );
+        seen = current;
+    }
+    m.done.store( true );
+    return nullptr;
+}
+
+void* measure_condvar( void* p ) {
+    auto& m = *static_cast<measurement*>(p);
+    m.tid = pth::this_thread::tid();
+    std::uint32_t seen = 0;
+    for ( long i = 0; i < m.opts->loops; i++ ) {
+        std::uint32_t current;
+        m.mtx.lock();
+        while ( ( current = m.seq.load( std::memory_order_relaxed ) ) == seen ) m.cv.wait( m.mtx );
+        m.mtx.unlock();
+        m.woken( seen, current, now_ns() );
+        seen = current;
+    }
+    m.done.store( true );
+    return nullptr;
+}
+
+// Wakes its measuring thread once per interval, stamping the time just 
+// before the wake
+void* pace( void* p ) {
+    auto& m = *static_cast<measurement*>(p);
+    pth::periodic period( std::chrono::microseconds( m.opts->interval_us ), pth::this_thread::sleep_mode::kernel );
+    std::uint32_t next = 1;
+    while ( !m.done.load() ) {
+        period.wait();
+        if ( m.opts->mode == wake_mode::futex ) {
+            m.stamps[next % measurement::stamp_ring].store( now_ns(), std::memory_order_relaxed );
+            m.seq.store( next++, std::memory_order_release );
+            pth::futex_wake( m.seq, 1 );
+        }
+        else {
+            m.mtx.lock();
+            m.stamps[next % measurement::stamp_ring].store( now_ns(), std::memory_order_relaxed );
+            m.seq.store( next++, std::memory_order_relaxed );
+            m.cv.signal();
+            m.mtx.unlock();
+        }
+    }
+    return nullptr;
+}
+
+
+void usage() {
+    std::cerr << "usage: pth_latency [-t threads] [-i interval_us] [-l loops] [-p rt_prio] [-a] [-m]\n"
+                 "                   [-w sleep|hybrid|futex|condvar] [-H]" << std::endl;
+}
+
+bool parse( int argc, char** argv, options& opts ) {
+    int c;
+    while ( ( c = ::getopt( argc, argv, "t:i:l:p:amw:H" ) ) != -1 ) {
+        switch ( c ) {
+            case 't': opts.threads = std::atoi( optarg ); break;
+            case 'i': opts.interval_us = std::atol( optarg ); break;
+            case 'l': opts.loops = std::atol( optarg ); break;
+            case 'p': opts.priority = std::atoi( optarg ); break;
+            case 'a': opts.pin = true; break;
+            case 'm': opts.lock_memory = true; break;
+            case 'H': opts.histogram = true; break;
+            case 'w':
+                if ( std::strcmp( optarg, "sleep" ) == 0 ) opts.mode = wake_mode::sleep;
+                else if ( std::strcmp( optarg, "hybrid" ) == 0 ) opts.mode = wake_mode::hybrid;
+                else if ( std::strcmp( optarg, "futex" ) == 0 ) opts.mode = wake_mode::futex;
+                else if ( std::strcmp( optarg, "condvar" ) == 0 ) opts.mode = wake_mode::condvar;
+                else return false;
+                break;
+            default: return false;
+        }
+    }
+    return opts.threads > 0 && opts.interval_us > 0 && opts.loops > 0;
+}
+
+} // namespace
+
+
+int main( int argc, char** argv ) {
+
+    options opts;
+    if ( !parse( argc, argv, opts ) ) {
+        usage();
+        return 2;
+    }
+
+    if ( opts.lock_memory && ::mlockall( MCL_CURRENT | MCL_FUTURE ) != 0 ) {
+        std::cerr << "mlockall: " << std::strerror( errno ) << ", continuing unlocked" << std::endl;
+    }
+
+    const long cpus = ::sysconf( _SC_NPROCESSORS_ONLN );
+    const pth::scheduling sched = opts.priority > 0 ? pth::scheduling::fifo( opts.priority ) 
+                                                    : pth::scheduling::other();
+
+    std::vector<measurement> runs( opts.threads );
+    std::vector<pth::rt_thread> threads;
+    std::vector<pth::rt_thread> pacers;
+    void* (*measure)(void*) = opts.mode == wake_mode::sleep ? measure_sleep 
+                            : opts.mode == wake_mode::hybrid ? measure_hybrid
+                            : opts.mode == wake_mode::futex ? measure_futex : measure_condvar;
+
+    for ( auto i{0}; i < opts.threads; i++ ) {
+        runs[i].opts = &opts;
+        runs[i].index = i;
+
+        ::pthread_attr_t attr;
+        ::pthread_attr_init( &attr );
+        if ( opts.pin ) {
+            ::cpu_set_t set;
+            CPU_ZERO( &set );
+            CPU_SET( i % cpus, &set );
+            ::pthread_attr_setaffinity_np( &attr, sizeof(set), &set );
+        }
+
+        threads.emplace_back( sched, attr, measure, &runs[i] );
+        if ( threads.back().error() ) {
+            std::cerr << "thread " << i << ": " << std::strerror( threads.back().error() ) 
+                      << ", running with SCHED_OTHER" << std::endl;
+            threads.back().join();
+            threads.back() = pth::rt_thread( pth::scheduling::other(), attr, measure, &runs[i] );
+        }
+        if ( opts.mode == wake_mode::futex || opts.mode == wake_mode::condvar ) {
+            pacers.emplace_back( sched, attr, pace, &runs[i] );
+            if ( pacers.back().error() ) {
+                pacers.back().join();
+                pacers.back() = pth::rt_thread( pth::scheduling::other(), attr, pace, &runs[i] );
+            }
+        }
+        ::pthread_attr_destroy( &attr );
+    }
+
+    for ( auto& t : threads ) t.join();
+    for ( auto& t : pacers ) t.join();
+
+    const char* mode = opts.mode == wake_mode::sleep ? "sleep" : opts.mode == wake_mode::hybrid ? "hybrid" 
+                     : opts.mode == wake_mode::futex ? "futex" : "condvar";
+    std::cout << "# mode " << mode << ", interval " << opts.interval_us << " us, policy " 
+              << ( opts.priority > 0 ? "SCHED_FIFO" : "SCHED_OTHER" ) << ", latencies in us" << std::endl;
+    for ( const auto& m : runs ) {
+        std::cout << "T:" << std::setw(2) << m.index << " (" << std::setw(7) << m.tid << ")"
+                  << " C:" << std::setw(8) << m.count
+                  << " M:" << std::setw(6) << m.missed
+                  << " Min:" << std::setw(7) << m.min / 1000
+                  << " Avg:" << std::setw(7) << ( m.count ? m.sum / m.count / 1000 : 0 )
+                  << " P99:" << std::setw(7) << m.percentile( 0.99 )
+                  << " P99.99:" << std::setw(7) << m.percentile( 0.9999 )
+                  << " Max:" << std::setw(7) << m.max / 1000 << std::endl;
+    }
+
+    if ( opts.histogram ) {
+        int last = 0;
+        for ( const auto& m : runs ) {
+            for ( int us = 0; us < buckets; us++ ) if ( m.histogram[us] && us > last ) last = us;
+        }
+        for ( int us = 0; us <= last; us++ ) {
+            bool any = false;
+            for ( const auto& m : runs ) any = any || m.histogram[us];
+            if ( !any ) continue;
+            std::cout << std::setw(6) << us;
+            for ( const auto& m : runs ) std::cout << " " << std::setw(8) << m.histogram[us];
+            std::cout << std::endl;
+        }
+    }
+
+}
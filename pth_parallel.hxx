@@ -0,0 +1,422 @@
+//
+//
+//  Loop parallelism on a pth pool: parallel_for and parallel_reduce over
+//  index ranges, with static, dynamic and guided partitioning, and on top
+//  of them parallel_sort and prefix scans.
+//
+//
+
+
+#ifndef PTH_PARALLEL_HXX
+#define PTH_PARALLEL_HXX
+
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "pth.hxx"
+#include "pth_pool.hxx"
+
+
+namespace pth {
+
+// How a range is cut into chunks. static_blocks makes one contiguous block
+// per pool worker, and block i goes to worker i whenever that worker is
+// free to take it, so repeated loops over the same range find their data in
+// the same caches. dynamic hands out chunks of a fixed size in order, guided
+// starts with large chunks (remaining / 2 workers) that shrink down to
+// min_chunk. Chunk boundaries never depend on timing.
+
+struct partition {
+    enum mode { static_mode, dynamic_mode, guided_mode };
+
+    mode kind = static_mode;
+    std::size_t chunk = 0;
+
+    static partition static_blocks() noexcept { return partition{}; }
+    static partition dynamic( std::size_t chunk = 1 ) noexcept { return partition{ dynamic_mode, std::max<std::size_t>( chunk, 1 ) }; }
+    static partition guided( std::size_t min_chunk = 1 ) noexcept { return partition{ guided_mode, std::max<std::size_t>( min_chunk, 1 ) }; }
+};
+
+// deterministic combines the partial results of the chunks in index order,
+// so floating point reductions give the same result on every run with the
+// same partition and pool size. any combines the chunks as they finish.
+enum class reduce_order { any, deterministic };
+
+
+namespace detail {
+
+// One parallel loop, alive on the caller's stack until every participant
+// task has returned. Body is called as body( begin, end ) with offsets into
+// the range, once per chunk.
+template<class Body>
+class chunk_loop {
+public:
+    chunk_loop( std::size_t n, partition part, std::size_t workers, Body& body )
+        : _n( n ), _part( part ), _workers( workers ), _body( body ) {
+        if ( part.kind == partition::static_mode ) _claimed.reset( new std::atomic<bool>[workers]() );
+    }
+
+    // Expected number of chunks, to size the participants
+    std::size_t chunks() const noexcept {
+        if ( _part.kind == partition::dynamic_mode ) return ( _n + _part.chunk - 1 ) / _part.chunk;
+        return _workers;
+    }
+
+    template<class Pool>
+    void run( Pool& pool );
+
+    void participate( int worker ) noexcept;
+
+private:
+
+    bool next_chunk( std::size_t home, std::size_t& cursor, std::size_t& begin, std::size_t& end ) noexcept;
+    void finish() noexcept;
+
+    const std::size_t _n;
+    const partition _part;
+    const std::size_t _workers;
+    Body& _body;
+    std::unique_ptr<std::atomic<bool>[]> _claimed;
+    std::atomic<std::size_t> _next{ 0 };
+    std::atomic<std::uint32_t> _remaining{ 0 };
+    std::atomic<bool> _failed{ false };
+    std::exception_ptr _error;
+};
+
+template<class Body>
+inline bool chunk_loop<Body>::next_chunk( std::size_t home, std::size_t& cursor,
+                                          std::size_t& begin, std::size_t& end ) noexcept {
+    if ( _failed.load( std::memory_order_relaxed ) ) return false;
+
+    switch ( _part.kind ) {
+        case partition::static_mode:
+            // own block first, then whatever the others have not started
+            while ( cursor < _workers ) {
+                const std::size_t block = ( home + cursor++ ) % _workers;
+                if ( !_claimed[block].load( std::memory_order_relaxed )
+                     && !_claimed[block].exchange( true, std::memory_order_relaxed ) ) {
+                    begin = _n * block / _workers;
+                    end = _n * ( block + 1 ) / _workers;
+                    if ( begin != end ) return true;
+                }
+            }
+            return false;
+
+        case partition::dynamic_mode: {
+            const std::size_t index = _next.fetch_add( 1, std::memory_order_relaxed );
+            if ( index >= chunks() ) return false;
+            begin = index * _part.chunk;
+            end = std::min( begin + _part.chunk, _n );
+            return true;
+        }
+
+        case partition::guided_mode: {
+            std::size_t b = _next.load( std::memory_order_relaxed );
+            do {
+                if ( b >= _n ) return false;
+                end = std::min( b + std::max( ( _n - b ) / ( 2 * _workers ), _part.chunk ), _n );
+            } while ( !_next.compare_exchange_weak( b, end, std::memory_order_relaxed ) );
+            begin = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+template<class Body>
+inline void chunk_loop<Body>::participate( int worker ) noexcept {
+    const std::size_t home = worker < 0 ? 0 : std::size_t( worker ) % _workers;
+    std::size_t cursor = 0, begin, end;
+    try {
+        while ( next_chunk( home, cursor, begin, end ) ) _body( begin, end );
+    }
+    catch ( ... ) {
+        if ( !_failed.exchange( true ) ) _error = std::current_exception();
+    }
+    finish();
+}
+
+template<class Body>
+inline void chunk_loop<Body>::finish() noexcept {
+    if ( _remaining.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) futex_wake( _remaining, INT_MAX );
+}
+
+// A caller that is one of the pool's workers takes part itself and runs
+// queued tasks while it waits, anyone else just sleeps, so it does not grab
+// blocks that belong to the workers. Participants that do not fit into the
+// pool's ring are dropped and the caller takes part in any case.
+template<class Body>
+template<class Pool>
+inline void chunk_loop<Body>::run( Pool& pool ) {
+    const int self = pool.worker_index();
+    const std::size_t tasks = std::min( _workers, chunks() );
+    _remaining.store( std::uint32_t( tasks ), std::memory_order_relaxed );
+
+    std::size_t sent = self < 0 ? 0 : 1;
+    while ( sent < tasks && pool.try_submit( [this, &pool] { participate( pool.worker_index() ); } ).valid() ) {
+        sent++;
+    }
+    if ( self >= 0 || sent < tasks ) {
+        const std::size_t dropped = self >= 0 ? tasks - sent : tasks - sent - 1;
+        if ( dropped ) _remaining.fetch_sub( std::uint32_t( dropped ), std::memory_order_relaxed );
+        participate( self );
+    }
+
+    for ( ;; ) {
+        const std::uint32_t left = _remaining.load( std::memory_order_acquire );
+        if ( left == 0 ) break;
+        if ( self >= 0 && pool.run_pending() ) continue;
+        futex_wait( _remaining, left );
+    }
+    if ( _error ) std::rethrow_exception( _error );
+}
+
+} // namespace detail
+
+
+// Calls body( i ) for every i in [first, last), or body( begin, end ) once
+// per chunk if it takes two indices. Returns when all of them have finished,
+// the first exception thrown by body is rethrown and stops the remaining
+// chunks from starting.
+
+template<class Pool, std::integral Index, class Body>
+void parallel_for( Pool& pool, Index first, Index last, Body&& body, partition part = partition::static_blocks() ) {
+    if ( !( first < last ) ) return;
+    const std::size_t n = std::size_t( last - first );
+
+    auto chunk = [first, &body]( std::size_t begin, std::size_t end ) {
+        if constexpr ( std::is_invocable_v<Body&, Index, Index> ) {
+            body( Index( first + begin ), Index( first + end ) );
+        }
+        else {
+            for ( std::size_t i = begin; i < end; i++ ) body( Index( first + i ) );
+        }
+    };
+    detail::chunk_loop<decltype(chunk)> loop( n, part, pool.size(), chunk );
+    loop.run( pool );
+}
+
+
+// combine( ..., combine( combine( identity, map( first ) ), map( first + 1 ) ) ... )
+// in some grouping, combine has to be associative and identity neutral.
+// With reduce_order::deterministic the grouping only depends on the
+// partition and the pool size.
+
+template<class Pool, std::integral Index, class T, class Map, class Combine>
+T parallel_reduce( Pool& pool, Index first, Index last, T identity, Map&& map, Combine&& combine,
+                   partition part = partition::static_blocks(), reduce_order order = reduce_order::any ) {
+    if ( !( first < last ) ) return identity;
+    const std::size_t n = std::size_t( last - first );
+
+    hybrid_mutex lock;
+    std::vector<std::pair<std::size_t, T>> partials;
+    T result = identity;
+
+    auto chunk = [&]( std::size_t begin, std::size_t end ) {
+        T acc = identity;
+        for ( std::size_t i = begin; i < end; i++ ) acc = combine( std::move( acc ), map( Index( first + i ) ) );
+        lock.lock();
+        if ( order == reduce_order::deterministic ) {
+            partials.emplace_back( begin, std::move( acc ) );
+        }
+        else {
+            result = combine( std::move( result ), std::move( acc ) );
+        }
+        lock.unlock();
+    };
+    detail::chunk_loop<decltype(chunk)> loop( n, part, pool.size(), chunk );
+    if ( order == reduce_order::deterministic ) partials.reserve( loop.chunks() );
+    loop.run( pool );
+
+    if ( order == reduce_order::deterministic ) {
+        std::sort( partials.begin(), partials.end(),
+                   []( const auto& a, const auto& b ) { return a.first < b.first; } );
+        for ( auto& p : partials ) result = combine( std::move( result ), std::move( p.second ) );
+    }
+    return result;
+}
+
+
+// Ranges shorter than this are sorted / scanned sequentially
+constexpr std::size_t parallel_cutoff = 16384;
+
+
+namespace detail {
+
+// Split point of merging [a, a + na) and [b, b + nb): the i with i elements 
+// from a and d - i from b making up the first d elements of the merge 
+// (merge path), taking from a first on ties like std::merge
+template<class It, class Compare>
+std::size_t merge_split( It a, std::size_t na, It b, std::size_t nb, std::size_t d, Compare& comp ) {
+    std::size_t lo = d > nb ? d - nb : 0;
+    std::size_t hi = std::min( d, na );
+    while ( lo < hi ) {
+        const std::size_t i = lo + ( hi - lo ) / 2;
+        if ( comp( b[d - i - 1], a[i] ) ) hi = i;
+        else lo = i + 1;
+    }
+    return lo;
+}
+
+// One round of merging adjacent sorted runs from src into dst, every merge 
+// cut into parts along its merge path so all workers have work even when 
+// only one pair is left. The cuts are found up front, the parts move their 
+// elements out of src.
+template<class Pool, class Src, class Dst, class Compare>
+void merge_round( Pool& pool, Src src, Dst dst, const std::vector<std::size_t>& runs, Compare& comp ) {
+    const std::size_t last = runs.size() - 1;
+    const std::size_t pairs = ( last + 1 ) / 2;
+    const std::size_t parts = std::max<std::size_t>( 1, 2 * pool.size() / pairs );
+
+    struct cut { std::size_t lo, mid, hi, d, i; };
+    std::vector<cut> cuts;
+    cuts.reserve( pairs * ( parts + 1 ) );
+    for ( std::size_t pair = 0; pair < pairs; pair++ ) {
+        const std::size_t lo = runs[2 * pair];
+        const std::size_t mid = runs[std::min( 2 * pair + 1, last )];
+        const std::size_t hi = runs[std::min( 2 * pair + 2, last )];
+        for ( std::size_t part = 0; part <= parts; part++ ) {
+            const std::size_t d = ( hi - lo ) * part / parts;
+            cuts.push_back( cut{ lo, mid, hi, d, merge_split( src + lo, mid - lo, src + mid, hi - mid, d, comp ) } );
+        }
+    }
+
+    parallel_for( pool, std::size_t( 0 ), pairs * parts, [&]( std::size_t job ) {
+        const cut& c0 = cuts[job / parts * ( parts + 1 ) + job % parts];
+        const cut& c1 = ( &c0 )[1];
+        std::merge( std::make_move_iterator( src + c0.lo + c0.i ), std::make_move_iterator( src + c0.lo + c1.i ),
+                    std::make_move_iterator( src + c0.mid + ( c0.d - c0.i ) ), 
+                    std::make_move_iterator( src + c0.mid + ( c1.d - c1.i ) ),
+                    dst + c0.lo + c0.d, comp );
+    }, partition::dynamic( 1 ) );
+}
+
+} // namespace detail
+
+
+// Unstable sort like std::sort: blocks sorted in parallel, then merged 
+// pairwise in rounds through a buffer of the same size. Needs a default 
+// constructible value type for the buffer.
+
+template<class Pool, std::random_access_iterator It, class Compare = std::less<>>
+void parallel_sort( Pool& pool, It first, It last, Compare comp = Compare(), std::size_t cutoff = parallel_cutoff ) {
+    using T = std::iter_value_t<It>;
+    const std::size_t n = std::size_t( last - first );
+    const std::size_t blocks = std::min( n / std::max<std::size_t>( cutoff, 1 ), 2 * pool.size() );
+    if ( blocks < 2 || pool.size() < 2 ) {
+        std::sort( first, last, comp );
+        return;
+    }
+
+    std::vector<std::size_t> runs( blocks + 1 );
+    for ( std::size_t b = 0; b <= blocks; b++ ) runs[b] = n * b / blocks;
+    parallel_for( pool, std::size_t( 0 ), blocks, [&]( std::size_t b ) {
+        std::sort( first + runs[b], first + runs[b + 1], comp );
+    }, partition::dynamic( 1 ) );
+
+    std::vector<T> buffer( n );
+    bool in_buffer = false;
+    while ( runs.size() > 2 ) {
+        if ( in_buffer ) detail::merge_round( pool, buffer.begin(), first, runs, comp );
+        else detail::merge_round( pool, first, buffer.begin(), runs, comp );
+        in_buffer = !in_buffer;
+
+        std::vector<std::size_t> merged;
+        for ( std::size_t r = 0; r < runs.size(); r += 2 ) merged.push_back( runs[r] );
+        if ( merged.back() != n ) merged.push_back( n );
+        runs.swap( merged );
+    }
+    if ( in_buffer ) {
+        parallel_for( pool, std::size_t( 0 ), n, [&]( std::size_t b, std::size_t e ) {
+            std::move( buffer.begin() + b, buffer.begin() + e, first + b );
+        } );
+    }
+}
+
+
+namespace detail {
+
+// Three phases over one static block per worker, which keeps each block on 
+// the same worker for phases one and three: block sums, a sequential scan of 
+// those, then every block scanned from its offset. Works in place.
+template<class Pool, class In, class Out, class T, class Op>
+void blocked_scan( Pool& pool, In first, std::size_t n, Out out, std::optional<T> init, Op& op ) {
+    const std::size_t blocks = pool.size();
+    std::vector<std::optional<T>> carry( blocks );
+
+    parallel_for( pool, std::size_t( 0 ), blocks, [&]( std::size_t b ) {
+        const std::size_t lo = n * b / blocks, hi = n * ( b + 1 ) / blocks;
+        if ( lo == hi || b + 1 == blocks ) return;
+        T sum = first[lo];
+        for ( std::size_t i = lo + 1; i < hi; i++ ) sum = op( std::move( sum ), first[i] );
+        carry[b] = std::move( sum );
+    }, partition::static_blocks() );
+
+    std::optional<T> acc = init;
+    for ( auto& c : carry ) {
+        if ( !c ) {
+            c = acc;
+            continue;
+        }
+        std::optional<T> next = acc ? op( *acc, *c ) : std::move( *c );
+        c = std::move( acc );
+        acc = std::move( next );
+    }
+
+    parallel_for( pool, std::size_t( 0 ), blocks, [&]( std::size_t b ) {
+        const std::size_t lo = n * b / blocks, hi = n * ( b + 1 ) / blocks;
+        std::optional<T> acc = carry[b];
+        for ( std::size_t i = lo; i < hi; i++ ) {
+            T x = first[i];
+            if ( init ) {       // exclusive
+                out[i] = *acc;
+                acc = op( std::move( *acc ), std::move( x ) );
+            }
+            else {
+                acc = acc ? op( std::move( *acc ), std::move( x ) ) : std::move( x );
+                out[i] = *acc;
+            }
+        }
+    }, partition::static_blocks() );
+}
+
+} // namespace detail
+
+
+// Like std::inclusive_scan / std::exclusive_scan, op has to be associative. 
+// out may be first for an in-place scan. Returns the end of the output.
+
+template<class Pool, std::random_access_iterator In, std::random_access_iterator Out, class Op = std::plus<>>
+Out parallel_inclusive_scan( Pool& pool, In first, In last, Out out, Op op = Op(), std::size_t cutoff = parallel_cutoff ) {
+    using T = std::iter_value_t<In>;
+    const std::size_t n = std::size_t( last - first );
+    if ( n < cutoff || pool.size() < 2 ) return std::inclusive_scan( first, last, out, op );
+    detail::blocked_scan( pool, first, n, out, std::optional<T>(), op );
+    return out + n;
+}
+
+template<class Pool, std::random_access_iterator In, std::random_access_iterator Out, class T, class Op = std::plus<>>
+Out parallel_exclusive_scan( Pool& pool, In first, In last, Out out, T init, Op op = Op(), std::size_t cutoff = parallel_cutoff ) {
+    const std::size_t n = std::size_t( last - first );
+    if ( n < cutoff || pool.size() < 2 ) return std::exclusive_scan( first, last, out, std::move( init ), op );
+    detail::blocked_scan( pool, first, n, out, std::optional<T>( std::move( init ) ), op );
+    return out + n;
+}
+
+} // namespace pth
+
+#endif // PTH_PARALLEL_HXX
@@ -0,0 +1,336 @@
+//
+//
+//  Fixed size thread pool for pth. Tasks are stored in place, as inline
+//  pth::basic_task, in the preallocated cells of a bounded ring, so
+//  submit() never allocates. Every submission returns a lightweight handle
+//  to wait for its completion.
+//
+//
+
+
+#ifndef PTH_POOL_HXX
+#define PTH_POOL_HXX
+
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pth.hxx"
+
+
+namespace pth {
+
+namespace detail {
+
+// Ring cell, one cache line with the default inline size. seq runs through
+// pos (free for the submission at pos), pos + 1 (task stored) and
+// pos + capacity (done, free for the next lap); waiters counts threads parked
+// on seq.
+
+template<std::size_t InlineSize>
+struct alignas(64) pool_cell {
+    std::atomic<std::uint32_t> seq;
+    std::atomic<std::uint32_t> waiters{ 0 };
+    basic_task<InlineSize> task;
+};
+
+// Set on pool workers, for basic_fixed_pool::worker_index()
+struct pool_worker_id {
+    const void* pool = nullptr;
+    int index = -1;
+};
+
+inline thread_local pool_worker_id this_pool_worker;
+
+} // namespace detail
+
+
+// Completion handle of a pool task, copyable. Once the task has finished, 
+// done() stays true while its cell is reused, for the next 2^31 submissions 
+// to the pool: the handle compares 32 bit ring positions, so a handle kept 
+// longer than that may read as not done again. Handles must not outlive 
+// their pool.
+
+class pool_handle {
+public:
+    pool_handle() noexcept = default;
+
+    bool valid() const noexcept { return _seq != nullptr; }
+    bool done() const noexcept { return finished( _seq->load( std::memory_order_acquire ) ); }
+    void wait() const noexcept;
+
+private:
+    template<std::size_t InlineSize> friend class basic_fixed_pool;
+
+    pool_handle( std::atomic<std::uint32_t>* seq, std::atomic<std::uint32_t>* waiters,
+                 std::uint32_t pos, std::uint32_t capacity ) noexcept
+        : _seq( seq ), _waiters( waiters ), _pos( pos ), _capacity( capacity ) { }
+
+    bool finished( std::uint32_t seq ) const noexcept { return std::int32_t( seq - _pos ) >= std::int32_t( _capacity ); }
+
+    std::atomic<std::uint32_t>* _seq = nullptr;
+    std::atomic<std::uint32_t>* _waiters = nullptr;
+    std::uint32_t _pos = 0;
+    std::uint32_t _capacity = 0;
+};
+
+inline void pool_handle::wait() const noexcept {
+    std::uint32_t s = _seq->load( std::memory_order_acquire );
+    if ( finished( s ) ) return;
+    _waiters->fetch_add( 1, std::memory_order_seq_cst );
+    while ( !finished( s = _seq->load( std::memory_order_seq_cst ) ) ) futex_wait( *_seq, s );
+    _waiters->fetch_sub( 1, std::memory_order_relaxed );
+}
+
+
+// N pth::thread workers serving a bounded FIFO ring. A callable has to be 
+// one that basic_task<InlineSize> stores inline, which is checked at compile 
+// time; others can be submitted wrapped into a basic_task<InlineSize>, which 
+// is relocated into the ring as is. Tasks must not throw (use
+// pth::async( pool, ... ) for results and exceptions). Workers default to
+// one per cpu, the capacity is rounded up to a power of two. When the ring
+// is full submit() blocks until the cell it needs is free again, try_submit()
+// returns an invalid handle instead. The destructor runs all submitted tasks
+// first.
+
+template<std::size_t InlineSize = 48>
+class basic_fixed_pool {
+public:
+    static constexpr std::size_t inline_size = InlineSize;
+
+    explicit basic_fixed_pool( unsigned workers = 0, std::size_t capacity = 1024 );
+    basic_fixed_pool( const ::pthread_attr_t& attrhandle, unsigned workers = 0, std::size_t capacity = 1024 );
+    ~basic_fixed_pool();
+
+    basic_fixed_pool( const basic_fixed_pool& other ) = delete;
+    basic_fixed_pool& operator=( const basic_fixed_pool& other ) = delete;
+
+    template<class F>
+    pool_handle submit( F&& f );
+
+    template<class F>
+    pool_handle try_submit( F&& f );
+
+    // Runs the oldest queued task on the calling thread, false if there is 
+    // none. For threads waiting on pool tasks, so waiting inside a task 
+    // cannot starve the pool.
+    bool run_pending();
+
+    // 0 .. size() - 1 on this pool's workers, fixed for the pool's lifetime, 
+    // -1 on any other thread
+    int worker_index() const noexcept {
+        return detail::this_pool_worker.pool == this ? detail::this_pool_worker.index : -1;
+    }
+
+    std::size_t size() const noexcept { return _workers.size(); }
+    std::size_t capacity() const noexcept { return _mask + 1; }
+
+private:
+
+    using cell = detail::pool_cell<InlineSize>;
+
+    template<class F>
+    static constexpr void check_task() {
+        using D = std::decay_t<F>;
+        static_assert( std::is_same_v<D, basic_task<InlineSize>> || basic_task<InlineSize>::template stored_inline<D>, 
+                       "task would need the heap, submit it as a basic_task<InlineSize>" );
+        static_assert( std::is_invocable_v<D&>, "task must be callable without arguments" );
+    }
+
+    template<class F>
+    pool_handle store( std::uint32_t pos, F&& f ) noexcept;
+
+    void wait_seq( cell& c, std::uint32_t expected ) noexcept;
+    static void set_seq( cell& c, std::uint32_t seq ) noexcept;
+
+    void start( const ::pthread_attr_t* attrhandle, unsigned workers, std::size_t capacity );
+    bool run_next( std::uint32_t pos );
+    bool quit_task( std::uint32_t pos ) const noexcept {
+        return _closing.load( std::memory_order_acquire ) && pos - _quit_from < _workers.size();
+    }
+    static void* work( void* self );
+
+    std::unique_ptr<cell[]> _cells;
+    std::uint32_t _mask;
+    alignas(64) std::atomic<std::uint32_t> _tail{ 0 };
+    alignas(64) std::atomic<std::uint32_t> _head{ 0 };
+    adaptive_spin _spin;
+    std::atomic<int> _started{ 0 };
+    std::atomic<bool> _closing{ false };
+    std::uint32_t _quit_from = 0;         // first quit task, set before _closing
+    std::vector<thread> _workers;
+};
+
+using fixed_pool = basic_fixed_pool<>;
+
+
+template<std::size_t InlineSize>
+inline basic_fixed_pool<InlineSize>::basic_fixed_pool( unsigned workers, std::size_t capacity ) {
+    start( nullptr, workers, capacity );
+}
+
+template<std::size_t InlineSize>
+inline basic_fixed_pool<InlineSize>::basic_fixed_pool( const ::pthread_attr_t& attrhandle, unsigned workers,
+                                                       std::size_t capacity ) {
+    start( &attrhandle, workers, capacity );
+}
+
+template<std::size_t InlineSize>
+inline void basic_fixed_pool<InlineSize>::start( const ::pthread_attr_t* attrhandle, unsigned workers,
+                                                 std::size_t capacity ) {
+    std::size_t n = 2;
+    while ( n < capacity ) n <<= 1;
+    _cells.reset( new cell[n] );
+    _mask = std::uint32_t( n - 1 );
+    for ( std::size_t i = 0; i < n; i++ ) _cells[i].seq.store( std::uint32_t( i ), std::memory_order_relaxed );
+
+    if ( workers == 0 ) {
+        const long cpus = ::sysconf( _SC_NPROCESSORS_ONLN );
+        workers = cpus > 0 ? unsigned( cpus ) : 1;
+    }
+    _workers.reserve( workers );
+    for ( unsigned i = 0; i < workers; i++ ) {
+        if ( attrhandle ) _workers.emplace_back( *attrhandle, work, this );
+        else _workers.emplace_back( work, this );
+    }
+}
+
+// One empty task per worker, which tells it to quit once everything
+// before it in the ring has run. They take consecutive positions so that
+// run_pending() can tell them apart and leave them to the workers.
+template<std::size_t InlineSize>
+inline basic_fixed_pool<InlineSize>::~basic_fixed_pool() {
+    const std::uint32_t quits = std::uint32_t( _workers.size() );
+    _quit_from = _tail.fetch_add( quits, std::memory_order_relaxed );
+    _closing.store( true, std::memory_order_release );
+    for ( std::uint32_t pos = _quit_from; pos != _quit_from + quits; pos++ ) {
+        cell& c = _cells[pos & _mask];
+        wait_seq( c, pos );
+        c.task.reset();
+        set_seq( c, pos + 1 );
+    }
+    for ( auto& w : _workers ) w.join();
+}
+
+// Spins for the adaptive budget before it parks, workers mostly wait here 
+// for the next submission
+template<std::size_t InlineSize>
+inline void basic_fixed_pool<InlineSize>::wait_seq( cell& c, std::uint32_t expected ) noexcept {
+    std::uint32_t s = c.seq.load( std::memory_order_acquire );
+    if ( s == expected ) return;
+
+    const std::uint64_t budget = _spin.budget();
+    if ( budget ) {
+        const std::uint64_t start = cycles();
+        do {
+            cpu_relax();
+            if ( c.seq.load( std::memory_order_acquire ) == expected ) {
+                _spin.spun( true );
+                return;
+            }
+        } while ( cycles() - start < budget );
+        _spin.spun( false );
+    }
+
+    c.waiters.fetch_add( 1, std::memory_order_seq_cst );
+    while ( ( s = c.seq.load( std::memory_order_seq_cst ) ) != expected ) futex_wait( c.seq, s );
+    c.waiters.fetch_sub( 1, std::memory_order_relaxed );
+}
+
+template<std::size_t InlineSize>
+inline void basic_fixed_pool<InlineSize>::set_seq( cell& c, std::uint32_t seq ) noexcept {
+    c.seq.store( seq, std::memory_order_seq_cst );
+    if ( c.waiters.load( std::memory_order_seq_cst ) ) futex_wake( c.seq, INT_MAX );
+}
+
+template<std::size_t InlineSize>
+template<class F>
+inline pool_handle basic_fixed_pool<InlineSize>::store( std::uint32_t pos, F&& f ) noexcept {
+    if constexpr ( std::is_same_v<std::decay_t<F>, basic_task<InlineSize>> ) assert( f );    // empty ones stop workers
+    cell& c = _cells[pos & _mask];
+    c.task = basic_task<InlineSize>( std::forward<F>(f) );
+    set_seq( c, pos + 1 );
+    return pool_handle( &c.seq, &c.waiters, pos, _mask + 1 );
+}
+
+template<std::size_t InlineSize>
+template<class F>
+inline pool_handle basic_fixed_pool<InlineSize>::submit( F&& f ) {
+    check_task<F>();
+    const std::uint32_t pos = _tail.fetch_add( 1, std::memory_order_relaxed );
+    cell& c = _cells[pos & _mask];
+    if ( c.seq.load( std::memory_order_acquire ) != pos ) {
+        // Ring full: let the workers drain half of it instead of waking up 
+        // for every single cell
+        const std::uint32_t mark = pos - ( _mask + 1 ) / 2;
+        cell& m = _cells[mark & _mask];
+        pool_handle( &m.seq, &m.waiters, mark, _mask + 1 ).wait();
+        wait_seq( c, pos );
+    }
+    return store( pos, std::forward<F>(f) );
+}
+
+template<std::size_t InlineSize>
+template<class F>
+inline pool_handle basic_fixed_pool<InlineSize>::try_submit( F&& f ) {
+    check_task<F>();
+    std::uint32_t pos = _tail.load( std::memory_order_relaxed );
+    for ( ;; ) {
+        const std::uint32_t s = _cells[pos & _mask].seq.load( std::memory_order_acquire );
+        if ( s != pos ) {
+            if ( std::int32_t( s - pos ) < 0 ) return pool_handle();     // cell still busy, ring full
+            pos = _tail.load( std::memory_order_relaxed );
+        }
+        else if ( _tail.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+            return store( pos, std::forward<F>(f) );
+        }
+    }
+}
+
+// Runs the task at a claimed position once it is stored, in place. false for 
+// a quit task.
+template<std::size_t InlineSize>
+inline bool basic_fixed_pool<InlineSize>::run_next( std::uint32_t pos ) {
+    cell& c = _cells[pos & _mask];
+    wait_seq( c, pos + 1 );
+    const bool quit = !c.task;
+    if ( !quit ) {
+        c.task();
+        c.task.reset();
+    }
+    set_seq( c, pos + _mask + 1 );
+    return !quit;
+}
+
+template<std::size_t InlineSize>
+inline bool basic_fixed_pool<InlineSize>::run_pending() {
+    std::uint32_t pos = _head.load( std::memory_order_relaxed );
+    do {
+        if ( _cells[pos & _mask].seq.load( std::memory_order_acquire ) != pos + 1 || quit_task( pos ) ) return false;
+    } while ( !_head.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) );
+    return run_next( pos );
+}
+
+// Every worker claims the next position up front and parks on that cell, so 
+// a submission wakes exactly the worker waiting for it, if any
+template<std::size_t InlineSize>
+inline void* basic_fixed_pool<InlineSize>::work( void* self ) {
+    auto& pool = *static_cast<basic_fixed_pool*>(self);
+    detail::this_pool_worker = { &pool, pool._started.fetch_add( 1, std::memory_order_relaxed ) };
+    while ( pool.run_next( pool._head.fetch_add( 1, std::memory_order_relaxed ) ) ) { }
+    return nullptr;
+}
+
+} // namespace pth
+
+#endif // PTH_POOL_HXX
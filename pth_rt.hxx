@@ -0,0 +1,395 @@
+//
+//
+//  Real-time support for pth threads: scheduling classes including 
+//  SCHED_DEADLINE (which pthread_attr_t cannot express) through 
+//  sched_setattr(2), applied at thread creation or changed live.
+//  All calls report failures (EPERM without CAP_SYS_NICE, EINVAL for 
+//  parameters the kernel rejects, EBUSY for deadline admission control) 
+//  as errno values instead of asserting. Also precise hybrid sleeps and a 
+//  fixed rate periodic driver for pacing loops.
+//
+//
+
+
+#ifndef PTH_RT_HXX
+#define PTH_RT_HXX
+
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <type_traits>
+#include <utility>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "pth.hxx"
+
+
+#ifndef SCHED_DEADLINE
+# define SCHED_DEADLINE 6
+#endif
+
+
+namespace pth {
+
+namespace detail {
+
+// Layout of the kernel's struct sched_attr (SCHED_ATTR_SIZE_VER0), glibc 
+// only ships it from 2.41 on
+struct kernel_sched_attr {
+    std::uint32_t size;
+    std::uint32_t sched_policy;
+    std::uint64_t sched_flags;
+    std::int32_t  sched_nice;
+    std::uint32_t sched_priority;
+    std::uint64_t sched_runtime;
+    std::uint64_t sched_deadline;
+    std::uint64_t sched_period;
+};
+
+constexpr std::uint64_t sched_flag_reset_on_fork = 0x01;
+
+} // namespace detail
+
+
+// One scheduling class with its parameters. priority is for SCHED_FIFO / 
+// SCHED_RR (1..99), nice for SCHED_OTHER / SCHED_BATCH, runtime <= deadline 
+// <= period for SCHED_DEADLINE (period 0 means period = deadline).
+
+struct scheduling {
+    int policy = SCHED_OTHER;
+    int priority = 0;
+    int nice = 0;
+    std::chrono::nanoseconds runtime{ 0 };
+    std::chrono::nanoseconds deadline{ 0 };
+    std::chrono::nanoseconds period{ 0 };
+    bool reset_on_fork = false;
+
+    static scheduling other( int nice = 0 ) { scheduling s; s.nice = nice; return s; }
+    static scheduling batch( int nice = 0 ) { scheduling s; s.policy = SCHED_BATCH; s.nice = nice; return s; }
+    static scheduling idle() { scheduling s; s.policy = SCHED_IDLE; return s; }
+    static scheduling fifo( int priority ) { scheduling s; s.policy = SCHED_FIFO; s.priority = priority; return s; }
+    static scheduling rr( int priority ) { scheduling s; s.policy = SCHED_RR; s.priority = priority; return s; }
+    static scheduling deadline_of( std::chrono::nanoseconds runtime, std::chrono::nanoseconds deadline, 
+                                   std::chrono::nanoseconds period = std::chrono::nanoseconds( 0 ) ) {
+        scheduling s;
+        s.policy = SCHED_DEADLINE;
+        s.runtime = runtime;
+        s.deadline = deadline;
+        s.period = period;
+        return s;
+    }
+};
+
+// tid 0 is the calling thread. Return 0 or an errno value.
+
+inline int set_scheduling( ::pid_t tid, const scheduling& s ) noexcept {
+    detail::kernel_sched_attr attr{};
+    attr.size = sizeof(attr);
+    attr.sched_policy = std::uint32_t( s.policy );
+    attr.sched_flags = s.reset_on_fork ? detail::sched_flag_reset_on_fork : 0;
+    attr.sched_nice = s.nice;
+    attr.sched_priority = std::uint32_t( s.priority );
+    attr.sched_runtime = std::uint64_t( s.runtime.count() );
+    attr.sched_deadline = std::uint64_t( s.deadline.count() );
+    attr.sched_period = std::uint64_t( s.period.count() );
+    return ::syscall( SYS_sched_setattr, tid, &attr, 0u ) == 0 ? 0 : errno;
+}
+
+inline int get_scheduling( ::pid_t tid, scheduling& s ) noexcept {
+    detail::kernel_sched_attr attr{};
+    if ( ::syscall( SYS_sched_getattr, tid, &attr, unsigned( sizeof(attr) ), 0u ) != 0 ) return errno;
+    s.policy = int( attr.sched_policy );
+    s.priority = int( attr.sched_priority );
+    s.nice = attr.sched_nice;
+    s.runtime = std::chrono::nanoseconds( attr.sched_runtime );
+    s.deadline = std::chrono::nanoseconds( attr.sched_deadline );
+    s.period = std::chrono::nanoseconds( attr.sched_period );
+    s.reset_on_fork = attr.sched_flags & detail::sched_flag_reset_on_fork;
+    return 0;
+}
+
+namespace this_thread {
+
+inline ::pid_t tid() noexcept { return ::pid_t( ::syscall( SYS_gettid ) ); }
+
+inline int set_scheduling( const scheduling& s ) noexcept { return pth::set_scheduling( 0, s ); }
+inline int get_scheduling( scheduling& s ) noexcept { return pth::get_scheduling( 0, s ); }
+
+} // namespace this_thread
+
+
+// Thread that switches to its scheduling class before the start routine runs. 
+// The constructor waits for that switch: if it fails, error() holds the errno 
+// value, the start routine is never called and the thread just ends, so 
+// nothing runs in the wrong class. If the thread cannot be created at all, 
+// error() holds the pthread_create error and the handle is not joinable. 
+// The kernel tid is kept for live changes, a joinable thread is joined on 
+// destruction like pth::thread.
+
+class rt_thread {
+public:
+    rt_thread( const scheduling& s, const ::pthread_attr_t& attrhandle, void* (*start_routine)(void*), void* arg = nullptr ) 
+        { spawn( s, &attrhandle, start_routine, arg ); }
+
+    rt_thread( const scheduling& s, void* (*start_routine)(void*), void* arg = nullptr ) 
+        { spawn( s, nullptr, start_routine, arg ); }
+
+    rt_thread() noexcept = default;
+
+    ~rt_thread() { join(); }
+
+    rt_thread( const rt_thread& ) = delete;
+    rt_thread& operator=( const rt_thread& ) = delete;
+
+    rt_thread( rt_thread&& other ) noexcept
+        : _handle( other._handle ), _joinable( std::exchange( other._joinable, false ) ), 
+          _tid( std::exchange( other._tid, 0 ) ), _error( std::exchange( other._error, 0 ) ) { }
+
+    rt_thread& operator=( rt_thread&& other ) noexcept {
+        if ( this != &other ) {
+            join();
+            _handle = other._handle;
+            _joinable = std::exchange( other._joinable, false );
+            _tid = std::exchange( other._tid, 0 );
+            _error = std::exchange( other._error, 0 );
+        }
+        return *this;
+    }
+
+    // 0 if the thread runs in the requested class
+    int error() const noexcept { return _error; }
+
+    bool joinable() const noexcept { return _joinable; }
+    ::pthread_t native_handle() noexcept { return _handle; }
+    ::pid_t tid() const noexcept { return _tid; }
+
+    void join( void** retval = nullptr ) {
+        if ( joinable() ) {
+            int ret = ::pthread_join( _handle, retval );
+            ASSERT_EQ0( ret );
+            _joinable = false;
+        }
+    }
+
+    int set_scheduling( const scheduling& s ) noexcept { return pth::set_scheduling( _tid, s ); }
+    int get_scheduling( scheduling& s ) const noexcept { return pth::get_scheduling( _tid, s ); }
+
+private:
+
+    struct start_block {
+        scheduling sched;
+        void* (*start_routine)(void*);
+        void* arg;
+        ::pid_t tid = 0;
+        int error = 0;
+        std::atomic<std::uint32_t> ready{ 0 };
+    };
+
+    static void* run( void* block );
+    void spawn( const scheduling& s, const ::pthread_attr_t* attrhandle, void* (*start_routine)(void*), void* arg );
+
+    ::pthread_t _handle{};
+    bool _joinable = false;
+    ::pid_t _tid = 0;
+    int _error = 0;
+};
+
+inline void* rt_thread::run( void* block ) {
+    auto& b = *static_cast<start_block*>(block);
+    void* (*start_routine)(void*) = b.start_routine;
+    void* arg = b.arg;
+
+    const int error = this_thread::set_scheduling( b.sched );
+    b.tid = this_thread::tid();
+    b.error = error;
+    b.ready.store( 1, std::memory_order_release );
+    futex_wake( b.ready, 1 );      // b lives on the creator's stack, gone from here on
+
+    return error ? nullptr : start_routine( arg );
+}
+
+inline void rt_thread::spawn( const scheduling& s, const ::pthread_attr_t* attrhandle, 
+                              void* (*start_routine)(void*), void* arg ) {
+    int detachstate = PTHREAD_CREATE_JOINABLE;
+    if ( attrhandle ) ::pthread_attr_getdetachstate( attrhandle, &detachstate );
+
+    start_block b{ s, start_routine, arg };
+    _error = ::pthread_create( &_handle, attrhandle, run, &b );
+    if ( _error ) return;
+    _joinable = ( detachstate == PTHREAD_CREATE_JOINABLE );
+    while ( b.ready.load( std::memory_order_acquire ) == 0 ) futex_wait( b.ready, 0 );
+    _tid = b.tid;
+    _error = b.error;
+}
+
+
+// Precise sleeping. hybrid sleeps in the kernel until a margin before the 
+// deadline and spins through the rest, so the wakeup is as exact as the clock 
+// while the core only burns the margin. The margin is calibrated on first 
+// use from the kernel's oversleep and then adapts: an overshoot widens it 
+// by up to half, spins much longer than needed slowly shrink it. Deadlines are on 
+// std::chrono::steady_clock, which is CLOCK_MONOTONIC.
+
+namespace this_thread {
+
+enum class sleep_mode { kernel, hybrid, spin };
+
+} // namespace this_thread
+
+namespace detail {
+
+constexpr std::int64_t min_sleep_margin = 1000;
+constexpr std::int64_t max_sleep_margin = 2000000;
+
+inline ::timespec monotonic_timespec( std::chrono::steady_clock::time_point tp ) noexcept {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>( tp.time_since_epoch() ).count();
+    return ::timespec{ std::time_t( ns / 1000000000 ), long( ns % 1000000000 ) };
+}
+
+inline void kernel_sleep_until( std::chrono::steady_clock::time_point tp ) noexcept {
+    const ::timespec ts = monotonic_timespec( tp );
+    while ( ::clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr ) == EINTR ) { }
+}
+
+// Twice the median oversleep of a few short kernel sleeps, the median so a 
+// preempted sample does not turn hybrid into spin
+inline std::int64_t calibrate_sleep_margin() noexcept {
+    using clock = std::chrono::steady_clock;
+    std::int64_t late[9];
+    for ( auto& l : late ) {
+        const auto deadline = clock::now() + std::chrono::microseconds( 50 );
+        kernel_sleep_until( deadline );
+        l = std::chrono::duration_cast<std::chrono::nanoseconds>( clock::now() - deadline ).count();
+    }
+    std::nth_element( late, late + 4, late + 9 );
+    return std::clamp( 2 * late[4], min_sleep_margin, max_sleep_margin );
+}
+
+inline std::atomic<std::int64_t>& sleep_margin() noexcept {
+    static std::atomic<std::int64_t> margin{ calibrate_sleep_margin() };
+    return margin;
+}
+
+} // namespace detail
+
+namespace this_thread {
+
+// Current hybrid margin
+inline std::chrono::nanoseconds sleep_margin() noexcept {
+    return std::chrono::nanoseconds( detail::sleep_margin().load( std::memory_order_relaxed ) );
+}
+
+inline void sleep_until( std::chrono::steady_clock::time_point tp, sleep_mode mode = sleep_mode::hybrid ) noexcept {
+    using clock = std::chrono::steady_clock;
+    if ( mode == sleep_mode::kernel ) {
+        detail::kernel_sleep_until( tp );
+        return;
+    }
+    if ( mode == sleep_mode::hybrid ) {
+        auto& margin = detail::sleep_margin();
+        const std::int64_t m = margin.load( std::memory_order_relaxed );
+        const auto wake = tp - std::chrono::nanoseconds( m );
+        if ( clock::now() < wake ) {
+            detail::kernel_sleep_until( wake );
+            const std::int64_t left = std::chrono::duration_cast<std::chrono::nanoseconds>( tp - clock::now() ).count();
+            if ( left < 0 ) {
+                margin.store( std::min( m + std::min( -left, m ) / 2, detail::max_sleep_margin ), std::memory_order_relaxed );
+                return;
+            }
+            if ( left > m / 2 ) margin.store( std::max( m - m / 32, detail::min_sleep_margin ), std::memory_order_relaxed );
+        }
+    }
+    while ( clock::now() < tp ) cpu_relax();
+}
+
+template<class Rep, class Period>
+inline void sleep_for( std::chrono::duration<Rep, Period> d, sleep_mode mode = sleep_mode::hybrid ) noexcept {
+    sleep_until( std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>( d ), mode );
+}
+
+} // namespace this_thread
+
+
+// Fixed rate driver on absolute deadlines start + n * period, so neither the 
+// callback's run time nor wakeup latency accumulates as drift. A cycle whose 
+// deadline has already passed when wait() is reached is an overrun and starts 
+// at once; deadlines passed entirely are skipped and counted as missed 
+// instead of being run back to back.
+
+class periodic {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit periodic( std::chrono::nanoseconds period, this_thread::sleep_mode mode = this_thread::sleep_mode::hybrid, 
+                       clock::time_point start = clock::now() ) noexcept
+        : _period( period ), _mode( mode ), _next( start + period ) { }
+
+    // Sleeps until the next deadline, returns the number of deadlines skipped
+    std::uint64_t wait() noexcept;
+
+    // Calls f() once per period until it returns false (if it returns bool) 
+    // or stop is requested
+    template<class F>
+    void run( F&& f, const stop_token& st = {} );
+
+    std::uint64_t cycles() const noexcept { return _cycles; }
+    std::uint64_t overruns() const noexcept { return _overruns; }
+    std::uint64_t missed() const noexcept { return _missed; }
+    std::chrono::nanoseconds max_lateness() const noexcept { return _max_lateness; }
+    std::chrono::nanoseconds period() const noexcept { return _period; }
+    clock::time_point next_deadline() const noexcept { return _next; }
+
+private:
+    std::chrono::nanoseconds _period;
+    this_thread::sleep_mode _mode;
+    clock::time_point _next;
+    std::uint64_t _cycles = 0;
+    std::uint64_t _overruns = 0;
+    std::uint64_t _missed = 0;
+    std::chrono::nanoseconds _max_lateness{ 0 };
+};
+
+inline std::uint64_t periodic::wait() noexcept {
+    std::uint64_t skipped = 0;
+    const auto now = clock::now();
+    if ( now >= _next ) {
+        _overruns++;
+        skipped = std::uint64_t( ( now - _next ) / _period );
+        _missed += skipped;
+        _next += skipped * _period;
+    }
+    else {
+        this_thread::sleep_until( _next, _mode );
+    }
+    const auto late = std::chrono::duration_cast<std::chrono::nanoseconds>( clock::now() - _next );
+    if ( late > _max_lateness ) _max_lateness = late;
+    _next += _period;
+    _cycles++;
+    return skipped;
+}
+
+template<class F>
+inline void periodic::run( F&& f, const stop_token& st ) {
+    while ( !st.stop_requested() ) {
+        wait();
+        if constexpr ( std::is_same_v<std::invoke_result_t<F&>, bool> ) {
+            if ( !f() ) return;
+        }
+        else {
+            f();
+        }
+    }
+}
+
+} // namespace pth
+
+#endif // PTH_RT_HXX
@@ -0,0 +1,502 @@
+//
+//
+//  A sender / receiver model in the style of P2300 (std::execution) on
+//  pth pools: just, schedule, then, when_all and bulk, plus sync_wait to
+//  run the result. Work scheduled on a pool runs on its workers, with the
+//  thread attributes and pinning the pool was created with.
+//
+//
+
+
+#ifndef PTH_SENDER_HXX
+#define PTH_SENDER_HXX
+
+
+#include <atomic>
+#include <climits>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <sched.h>
+
+#include "pth.hxx"
+#include "pth_parallel.hxx"
+#include "pth_pool.hxx"
+
+
+namespace pth::exec {
+
+// Senders name the values they complete with as value_types = types<Vs...>
+// and have a connect( receiver ) that returns an operation state with a
+// start() noexcept. Receivers take exactly one of set_value( vs... ),
+// set_error( std::exception_ptr ) and set_stopped() as an rvalue. A sender
+// whose values are produced on a pool also has a completion_scheduler().
+
+template<class... Ts>
+struct types { };
+
+template<class S>
+concept sender = requires { typename std::remove_cvref_t<S>::value_types; };
+
+template<class S>
+using value_types_of = typename std::remove_cvref_t<S>::value_types;
+
+template<class S, class R>
+using connect_result_t = decltype( std::declval<S>().connect( std::declval<R>() ) );
+
+namespace detail {
+
+template<class... Lists>
+struct concat_types { using type = types<>; };
+
+template<class... A>
+struct concat_types<types<A...>> { using type = types<A...>; };
+
+template<class... A, class... B, class... Rest>
+struct concat_types<types<A...>, types<B...>, Rest...> : concat_types<types<A..., B...>, Rest...> { };
+
+template<class List>
+struct decayed_tuple;
+
+template<class... Ts>
+struct decayed_tuple<types<Ts...>> { using type = std::tuple<std::decay_t<Ts>...>; };
+
+template<class List>
+using decayed_tuple_t = typename decayed_tuple<List>::type;
+
+template<class F, class List>
+struct invoke_types;
+
+template<class F, class... Ts>
+struct invoke_types<F, types<Ts...>> {
+    using result = std::invoke_result_t<F, Ts...>;
+    using type = std::conditional_t<std::is_void_v<result>, types<>, types<result>>;
+};
+
+template<class S>
+concept has_completion_scheduler = requires( const S& s ) { s.completion_scheduler(); };
+
+// Operation states can neither move nor copy, this builds one in place
+template<class S, class R>
+struct connected {
+    template<class Make>
+    explicit connected( Make make ) : op( make() ) { }
+
+    connect_result_t<S, R> op;
+};
+
+} // namespace detail
+
+
+template<class... Ts>
+class just_sender {
+public:
+    using value_types = types<Ts...>;
+
+    template<class R>
+    struct operation {
+        void start() noexcept {
+            std::apply( [this]( Ts&... vs ) { std::move( r ).set_value( std::move( vs )... ); }, values );
+        }
+
+        std::tuple<Ts...> values;
+        R r;
+    };
+
+    template<class... Vs>
+    explicit just_sender( Vs&&... vs ) : _values( std::forward<Vs>(vs)... ) { }
+
+    template<class R>
+    operation<R> connect( R r ) && { return { std::move( _values ), std::move( r ) }; }
+
+private:
+    std::tuple<Ts...> _values;
+};
+
+template<class... Vs>
+inline just_sender<std::decay_t<Vs>...> just( Vs&&... vs ) {
+    return just_sender<std::decay_t<Vs>...>( std::forward<Vs>(vs)... );
+}
+
+
+// Completes on one of the pool's workers. On a worker of the same pool
+// whose ring is full it completes right away instead, like task_group. 
+// Other threads yield until a cell is free rather than block in submit(), 
+// whose reserved cell would keep queued work of the workers waiting.
+
+template<class Pool>
+class pool_scheduler {
+public:
+    class sender {
+    public:
+        using value_types = types<>;
+
+        template<class R>
+        class operation {
+        public:
+            operation( Pool& pool, R r ) : _pool( pool ), _r( std::move( r ) ) { }
+
+            operation( const operation& other ) = delete;
+            operation& operator=( const operation& other ) = delete;
+
+            void start() noexcept;
+
+        private:
+            Pool& _pool;
+            R _r;
+        };
+
+        explicit sender( Pool& pool ) noexcept : _pool( &pool ) { }
+
+        template<class R>
+        operation<R> connect( R r ) const { return operation<R>( *_pool, std::move( r ) ); }
+
+        pool_scheduler completion_scheduler() const noexcept { return pool_scheduler( *_pool ); }
+
+    private:
+        Pool* _pool;
+    };
+
+    explicit pool_scheduler( Pool& pool ) noexcept : _pool( &pool ) { }
+
+    sender schedule() const noexcept { return sender( *_pool ); }
+    Pool& pool() const noexcept { return *_pool; }
+
+    bool operator==( const pool_scheduler& other ) const noexcept = default;
+
+private:
+    Pool* _pool;
+};
+
+template<class Pool>
+template<class R>
+inline void pool_scheduler<Pool>::sender::operation<R>::start() noexcept {
+    auto run = [this] { std::move( _r ).set_value(); };
+    const bool worker = _pool.worker_index() >= 0;
+    while ( !_pool.try_submit( run ).valid() ) {
+        if ( worker ) {
+            run();
+            return;
+        }
+        ::sched_yield();
+    }
+}
+
+template<class Scheduler>
+inline auto schedule( const Scheduler& sch ) noexcept {
+    return sch.schedule();
+}
+
+
+// then( s, f ) completes with f( values of s ), or with the exception f threw
+
+template<class S, class F>
+class then_sender {
+public:
+    using value_types = typename detail::invoke_types<F, value_types_of<S>>::type;
+
+    template<class R>
+    struct receiver {
+        template<class... Vs>
+        void set_value( Vs&&... vs ) && noexcept {
+            try {
+                if constexpr ( std::is_void_v<std::invoke_result_t<F, Vs...>> ) {
+                    std::invoke( f, std::forward<Vs>(vs)... );
+                    std::move( r ).set_value();
+                }
+                else {
+                    std::move( r ).set_value( std::invoke( f, std::forward<Vs>(vs)... ) );
+                }
+            }
+            catch ( ... ) {
+                std::move( r ).set_error( std::current_exception() );
+            }
+        }
+
+        void set_error( std::exception_ptr error ) && noexcept { std::move( r ).set_error( std::move( error ) ); }
+        void set_stopped() && noexcept { std::move( r ).set_stopped(); }
+
+        F f;
+        R r;
+    };
+
+    then_sender( S s, F f ) : _s( std::move( s ) ), _f( std::move( f ) ) { }
+
+    template<class R>
+    connect_result_t<S, receiver<R>> connect( R r ) && {
+        return std::move( _s ).connect( receiver<R>{ std::move( _f ), std::move( r ) } );
+    }
+
+    auto completion_scheduler() const requires detail::has_completion_scheduler<S> {
+        return _s.completion_scheduler();
+    }
+
+private:
+    S _s;
+    F _f;
+};
+
+template<sender S, class F>
+inline then_sender<std::decay_t<S>, std::decay_t<F>> then( S&& s, F&& f ) {
+    return { std::forward<S>(s), std::forward<F>(f) };
+}
+
+
+// bulk( s, n, f ) calls f( i, values... ) for every i in [0, n) and then
+// passes the values on. With a pool behind s the calls are spread over it
+// by parallel_for, otherwise they run one after the other.
+
+template<class S, std::integral Shape, class F>
+class bulk_sender {
+public:
+    using value_types = value_types_of<S>;
+
+    template<class R, class Pool>
+    struct receiver {
+        template<class... Vs>
+        void set_value( Vs&&... vs ) && noexcept {
+            try {
+                auto body = [&]( Shape i ) { std::invoke( f, i, vs... ); };
+                if constexpr ( std::is_void_v<Pool> ) {
+                    for ( Shape i = 0; i < n; i++ ) body( i );
+                }
+                else {
+                    parallel_for( *pool, Shape( 0 ), n, body );
+                }
+            }
+            catch ( ... ) {
+                std::move( r ).set_error( std::current_exception() );
+                return;
+            }
+            std::move( r ).set_value( std::forward<Vs>(vs)... );
+        }
+
+        void set_error( std::exception_ptr error ) && noexcept { std::move( r ).set_error( std::move( error ) ); }
+        void set_stopped() && noexcept { std::move( r ).set_stopped(); }
+
+        Pool* pool;
+        Shape n;
+        F f;
+        R r;
+    };
+
+    bulk_sender( S s, Shape n, F f ) : _s( std::move( s ) ), _n( n ), _f( std::move( f ) ) { }
+
+    template<class R>
+    auto connect( R r ) && {
+        if constexpr ( detail::has_completion_scheduler<S> ) {
+            auto& pool = _s.completion_scheduler().pool();
+            using Pool = std::remove_reference_t<decltype(pool)>;
+            return std::move( _s ).connect( receiver<R, Pool>{ &pool, _n, std::move( _f ), std::move( r ) } );
+        }
+        else {
+            return std::move( _s ).connect( receiver<R, void>{ nullptr, _n, std::move( _f ), std::move( r ) } );
+        }
+    }
+
+    auto completion_scheduler() const requires detail::has_completion_scheduler<S> {
+        return _s.completion_scheduler();
+    }
+
+private:
+    S _s;
+    Shape _n;
+    F _f;
+};
+
+template<sender S, std::integral Shape, class F>
+inline bulk_sender<std::decay_t<S>, Shape, std::decay_t<F>> bulk( S&& s, Shape n, F&& f ) {
+    return { std::forward<S>(s), n, std::forward<F>(f) };
+}
+
+
+// when_all( s... ) starts all of them and completes with all their values
+// once the last one is done. The first error wins, a stop without errors
+// makes the whole stop.
+
+template<class... S>
+class when_all_sender {
+public:
+    using value_types = typename detail::concat_types<value_types_of<S>...>::type;
+
+    template<class R, class Indices = std::index_sequence_for<S...>>
+    class operation;
+
+    template<class... Ss>
+    explicit when_all_sender( Ss&&... s ) : _senders( std::forward<Ss>(s)... ) { }
+
+    template<class R>
+    operation<R> connect( R r ) && { return operation<R>( std::move( _senders ), std::move( r ) ); }
+
+private:
+    std::tuple<S...> _senders;
+};
+
+template<class... S>
+template<class R, std::size_t... I>
+class when_all_sender<S...>::operation<R, std::index_sequence<I...>> {
+public:
+    template<std::size_t J>
+    struct receiver {
+        template<class... Vs>
+        void set_value( Vs&&... vs ) && noexcept {
+            try {
+                std::get<J>( op->_values ).emplace( std::forward<Vs>(vs)... );
+            }
+            catch ( ... ) {
+                op->fail( std::current_exception() );
+            }
+            op->arrive();
+        }
+
+        void set_error( std::exception_ptr error ) && noexcept {
+            op->fail( std::move( error ) );
+            op->arrive();
+        }
+
+        void set_stopped() && noexcept {
+            op->_stopped.store( true, std::memory_order_relaxed );
+            op->arrive();
+        }
+
+        operation* op;
+    };
+
+    operation( std::tuple<S...>&& senders, R r )
+        : _r( std::move( r ) ),
+          _children( [&] { return std::move( std::get<I>( senders ) ).connect( receiver<I>{ this } ); }... ) { }
+
+    operation( const operation& other ) = delete;
+    operation& operator=( const operation& other ) = delete;
+
+    void start() noexcept {
+        if constexpr ( sizeof...(S) == 0 ) std::move( _r ).set_value();
+        else ( std::get<I>( _children ).op.start(), ... );
+    }
+
+private:
+
+    void fail( std::exception_ptr error ) noexcept {
+        if ( !_failed.exchange( true ) ) _error = std::move( error );
+    }
+
+    void arrive() noexcept {
+        if ( _remaining.fetch_sub( 1, std::memory_order_acq_rel ) != 1 ) return;
+        if ( _error ) std::move( _r ).set_error( std::move( _error ) );
+        else if ( _stopped.load( std::memory_order_relaxed ) ) std::move( _r ).set_stopped();
+        else std::apply( [this]( auto&&... vs ) { std::move( _r ).set_value( std::forward<decltype(vs)>(vs)... ); },
+                         std::tuple_cat( std::move( *std::get<I>( _values ) )... ) );
+    }
+
+    R _r;
+    std::tuple<std::optional<detail::decayed_tuple_t<value_types_of<S>>>...> _values;
+    std::atomic<std::size_t> _remaining{ sizeof...(S) };
+    std::atomic<bool> _failed{ false };
+    std::atomic<bool> _stopped{ false };
+    std::exception_ptr _error;
+    std::tuple<detail::connected<S, receiver<I>>...> _children;
+};
+
+template<sender... S>
+inline when_all_sender<std::decay_t<S>...> when_all( S&&... s ) {
+    return when_all_sender<std::decay_t<S>...>( std::forward<S>(s)... );
+}
+
+
+// Pipes: s | then( f ), s | bulk( n, f )
+
+template<class F>
+struct then_closure {
+    template<sender S>
+    friend auto operator|( S&& s, then_closure c ) { return then( std::forward<S>(s), std::move( c.f ) ); }
+
+    F f;
+};
+
+template<class F>
+inline then_closure<std::decay_t<F>> then( F&& f ) {
+    return { std::forward<F>(f) };
+}
+
+template<std::integral Shape, class F>
+struct bulk_closure {
+    template<sender S>
+    friend auto operator|( S&& s, bulk_closure c ) { return bulk( std::forward<S>(s), c.n, std::move( c.f ) ); }
+
+    Shape n;
+    F f;
+};
+
+template<std::integral Shape, class F>
+inline bulk_closure<Shape, std::decay_t<F>> bulk( Shape n, F&& f ) {
+    return { n, std::forward<F>(f) };
+}
+
+
+// Runs s and blocks the calling thread until it completes: its values, an
+// empty optional if it stopped, its error rethrown. Not from a pool worker
+// the sender needs, the thread only sleeps.
+
+namespace detail {
+
+template<class Values>
+struct sync_state {
+    std::optional<Values> result;
+    std::exception_ptr error;
+    std::atomic<std::uint32_t> done{ 0 };
+};
+
+template<class Values>
+struct sync_receiver {
+    template<class... Vs>
+    void set_value( Vs&&... vs ) && noexcept {
+        try {
+            st->result.emplace( std::forward<Vs>(vs)... );
+        }
+        catch ( ... ) {
+            st->error = std::current_exception();
+        }
+        finish();
+    }
+
+    void set_error( std::exception_ptr error ) && noexcept {
+        st->error = std::move( error );
+        finish();
+    }
+
+    void set_stopped() && noexcept { finish(); }
+
+    // sync_wait() may return as soon as done is set, st is gone by then
+    void finish() noexcept {
+        std::atomic<std::uint32_t>& done = st->done;
+        done.store( 1, std::memory_order_release );
+        futex_wake( done, INT_MAX );
+    }
+
+    sync_state<Values>* st;
+};
+
+} // namespace detail
+
+template<sender S>
+auto sync_wait( S&& s ) -> std::optional<detail::decayed_tuple_t<value_types_of<S>>> {
+    using values = detail::decayed_tuple_t<value_types_of<S>>;
+
+    detail::sync_state<values> st;
+    auto op = std::forward<S>(s).connect( detail::sync_receiver<values>{ &st } );
+    op.start();
+    while ( st.done.load( std::memory_order_acquire ) == 0 ) futex_wait( st.done, 0 );
+    if ( st.error ) std::rethrow_exception( st.error );
+    return std::move( st.result );
+}
+
+} // namespace pth::exec
+
+#endif // PTH_SENDER_HXX
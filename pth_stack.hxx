@@ -0,0 +1,496 @@
+//
+//
+//  Thread stacks for pth: a pool of preallocated stacks with guard pages, 
+//  optionally backed by huge pages and prefaulted, handed to threads via 
+//  pthread_attr_setstack and recycled on join. Painted stacks report their 
+//  high-water mark, and a stack_advisor turns measured usage into stack 
+//  sizes per thread role.
+//
+//
+
+
+#ifndef PTH_STACK_HXX
+#define PTH_STACK_HXX
+
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pth.hxx"
+
+
+namespace pth {
+
+namespace detail {
+
+constexpr std::uint64_t stack_paint = 0x5354414b5041494eULL;   // "STAKPAIN"
+
+inline std::size_t page_size() noexcept {
+    static const std::size_t size = std::size_t( ::sysconf( _SC_PAGESIZE ) );
+    return size;
+}
+
+// Default huge page size from /proc/meminfo, 0 if there is none
+inline std::size_t huge_page_size() noexcept {
+    static const std::size_t size = [] {
+        std::size_t kb = 0;
+        if ( std::FILE* f = std::fopen( "/proc/meminfo", "r" ) ) {
+            char line[128];
+            while ( std::fgets( line, sizeof(line), f ) ) {
+                if ( std::sscanf( line, "Hugepagesize: %zu kB", &kb ) == 1 ) break;
+            }
+            std::fclose( f );
+        }
+        return kb * 1024;
+    }();
+    return size;
+}
+
+inline std::size_t round_up( std::size_t n, std::size_t to ) noexcept { return ( n + to - 1 ) / to * to; }
+
+inline void paint( void* base, std::size_t bytes ) noexcept {
+    auto* p = static_cast<std::uint64_t*>(base);
+    for ( std::size_t i = 0; i < bytes / sizeof(std::uint64_t); i++ ) p[i] = stack_paint;
+}
+
+// Bytes from the top of [base, base + size) that no longer carry the paint
+inline std::size_t painted_usage( const void* base, std::size_t size ) noexcept {
+    const auto* p = static_cast<const std::uint64_t*>(base);
+    const std::size_t words = size / sizeof(std::uint64_t);
+    std::size_t i = 0;
+    while ( i < words && p[i] == stack_paint ) i++;
+    return size - i * sizeof(std::uint64_t);
+}
+
+// Everything but stack and detach state: scheduling, scope and affinity. 
+// glibc reports all CPUs for an attr without a CPU set, that default is not 
+// copied so the thread still inherits the creator's affinity.
+inline void copy_thread_attrs( const ::pthread_attr_t& from, ::pthread_attr_t& to ) noexcept {
+    int value;
+    ::sched_param param{};
+    if ( ::pthread_attr_getinheritsched( &from, &value ) == 0 ) ::pthread_attr_setinheritsched( &to, value );
+    if ( ::pthread_attr_getschedpolicy( &from, &value ) == 0 ) ::pthread_attr_setschedpolicy( &to, value );
+    if ( ::pthread_attr_getschedparam( &from, &param ) == 0 ) ::pthread_attr_setschedparam( &to, &param );
+    if ( ::pthread_attr_getscope( &from, &value ) == 0 ) ::pthread_attr_setscope( &to, value );
+    ::cpu_set_t set;
+    if ( ::pthread_attr_getaffinity_np( &from, sizeof(set), &set ) == 0 && CPU_COUNT( &set ) < CPU_SETSIZE ) {
+        ::pthread_attr_setaffinity_np( &to, sizeof(set), &set );
+    }
+}
+
+} // namespace detail
+
+
+// Fixed number of equally sized stacks carved from one mapping, each with a 
+// PROT_NONE guard below it. With huge_pages the mapping uses MAP_HUGETLB and 
+// falls back to normal pages when none are reserved (see huge_pages()); 
+// guards are then a whole huge page. populate prefaults the mapping, paint 
+// fills stacks with a pattern so their high-water mark can be measured. 
+// The constructor throws std::system_error if the mapping fails.
+
+class stack_pool {
+public:
+    enum options : unsigned { none = 0, huge_pages = 1, populate = 2, paint = 4 };
+
+    struct stack {
+        void* base;               // lowest usable address
+        std::size_t size;
+        std::size_t index;
+    };
+
+    stack_pool( std::size_t stack_size, std::size_t count, unsigned opts = none );
+    ~stack_pool();   // all stacks have to be back
+
+    stack_pool( const stack_pool& other ) = delete;
+    stack_pool& operator=( const stack_pool& other ) = delete;
+
+    // nullptr when the pool is exhausted
+    stack* acquire();
+    // Returns the high-water mark in bytes, 0 unless the pool paints
+    std::size_t release( stack* s );
+
+    std::size_t high_water_mark( const stack& s ) const noexcept;
+    std::size_t max_high_water_mark() const noexcept { return _max_hwm.load( std::memory_order_relaxed ); }
+
+    std::size_t stack_size() const noexcept { return _stack_size; }
+    std::size_t available();
+    bool uses_huge_pages() const noexcept { return _huge; }
+
+private:
+
+    unsigned _opts;
+    bool _huge = false;
+    std::size_t _stack_size;
+    std::size_t _slot_size;
+    std::size_t _guard_size;
+    std::size_t _map_size = 0;
+    char* _region = nullptr;
+
+    std::vector<stack> _stacks;
+    std::vector<std::size_t> _painted;   // bytes from the top that need repainting, SIZE_MAX = all
+    hybrid_mutex _lock;                  // guards _free
+    std::vector<std::size_t> _free;
+    std::atomic<std::size_t> _max_hwm{ 0 };
+};
+
+inline stack_pool::stack_pool( std::size_t stack_size, std::size_t count, unsigned opts ) : _opts( opts ) {
+    const int prot = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | ( opts & populate ? MAP_POPULATE : 0 );
+
+    const std::size_t huge = detail::huge_page_size();
+    if ( ( opts & huge_pages ) && huge ) {
+        _guard_size = huge;
+        _stack_size = detail::round_up( stack_size, huge );
+        _slot_size = _guard_size + _stack_size;
+        _map_size = _slot_size * count;
+        void* p = ::mmap( nullptr, _map_size, prot, flags | MAP_HUGETLB, -1, 0 );
+        if ( p != MAP_FAILED ) {
+            _region = static_cast<char*>(p);
+            _huge = true;
+        }
+    }
+    if ( !_region ) {
+        _guard_size = detail::page_size();
+        _stack_size = detail::round_up( stack_size, detail::page_size() );
+        _slot_size = _guard_size + _stack_size;
+        _map_size = _slot_size * count;
+        void* p = ::mmap( nullptr, _map_size, prot, flags, -1, 0 );
+        if ( p == MAP_FAILED ) throw std::system_error( errno, std::generic_category(), "stack_pool: mmap" );
+        _region = static_cast<char*>(p);
+    }
+
+    _stacks.reserve( count );
+    _free.reserve( count );
+    for ( std::size_t i = 0; i < count; i++ ) {
+        char* slot = _region + i * _slot_size;
+        int retval = ::mprotect( slot, _guard_size, PROT_NONE );
+        ASSERT_EQ0( retval );
+        _stacks.push_back( stack{ slot + _guard_size, _stack_size, i } );
+        _free.push_back( count - 1 - i );
+    }
+    _painted.assign( count, SIZE_MAX );
+}
+
+inline stack_pool::~stack_pool() {
+    assert( _free.size() == _stacks.size() );
+    ::munmap( _region, _map_size );
+}
+
+inline stack_pool::stack* stack_pool::acquire() {
+    _lock.lock();
+    if ( _free.empty() ) {
+        _lock.unlock();
+        return nullptr;
+    }
+    stack* s = &_stacks[_free.back()];
+    _free.pop_back();
+    _lock.unlock();
+
+    if ( _opts & paint ) {
+        // Only what the previous user dirtied has to be painted again
+        std::size_t& dirty = _painted[s->index];
+        std::size_t bytes = dirty > s->size ? s->size : dirty;
+        detail::paint( static_cast<char*>(s->base) + s->size - bytes, bytes );
+        dirty = 0;
+    }
+    return s;
+}
+
+inline std::size_t stack_pool::high_water_mark( const stack& s ) const noexcept {
+    if ( !( _opts & paint ) ) return 0;
+    return detail::painted_usage( s.base, s.size );
+}
+
+inline std::size_t stack_pool::release( stack* s ) {
+    std::size_t hwm = high_water_mark( *s );
+    _painted[s->index] = hwm;
+
+    std::size_t max = _max_hwm.load( std::memory_order_relaxed );
+    while ( hwm > max && !_max_hwm.compare_exchange_weak( max, hwm, std::memory_order_relaxed ) ) { }
+
+    _lock.lock();
+    _free.push_back( s->index );
+    _lock.unlock();
+    return hwm;
+}
+
+inline std::size_t stack_pool::available() {
+    _lock.lock();
+    std::size_t n = _free.size();
+    _lock.unlock();
+    return n;
+}
+
+
+// Joinable thread running on a pool stack. The stack goes back to the pool 
+// when the thread is joined, so there is no detach.
+
+class pooled_thread {
+public:
+    pooled_thread( stack_pool& pool, const ::pthread_attr_t& attrhandle, 
+                   void* (*start_routine)(void*), void* arg = nullptr ) 
+        { spawn( pool, &attrhandle, start_routine, arg ); }
+
+    pooled_thread( stack_pool& pool, void* (*start_routine)(void*), void* arg = nullptr ) 
+        { spawn( pool, nullptr, start_routine, arg ); }
+
+    pooled_thread() noexcept = default;
+    ~pooled_thread() { join(); }
+
+    pooled_thread( const pooled_thread& ) = delete;
+    pooled_thread& operator=( const pooled_thread& ) = delete;
+
+    pooled_thread( pooled_thread&& other ) noexcept 
+        : _thread( std::move( other._thread ) ), _pool( std::exchange( other._pool, nullptr ) ), 
+          _stack( std::exchange( other._stack, nullptr ) ), _hwm( other._hwm ) { }
+
+    pooled_thread& operator=( pooled_thread&& other ) noexcept {
+        if ( this != &other ) {
+            join();
+            _thread = std::move( other._thread );
+            _pool = std::exchange( other._pool, nullptr );
+            _stack = std::exchange( other._stack, nullptr );
+            _hwm = other._hwm;
+        }
+        return *this;
+    }
+
+    // Not joinable right after construction if the pool had no stack left
+    bool joinable() const noexcept { return _thread.joinable(); }
+    ::pthread_t native_handle() noexcept { return _thread.native_handle(); }
+
+    void join( void** retval = nullptr );
+
+    // Stack bytes used, known after join (and only with stack_pool::paint)
+    std::size_t stack_high_water() const noexcept { return _hwm; }
+
+private:
+
+    void spawn( stack_pool& pool, const ::pthread_attr_t* attrhandle, void* (*start_routine)(void*), void* arg );
+
+    thread _thread;
+    stack_pool* _pool = nullptr;
+    stack_pool::stack* _stack = nullptr;
+    std::size_t _hwm = 0;
+};
+
+inline void pooled_thread::spawn( stack_pool& pool, const ::pthread_attr_t* attrhandle, 
+                                  void* (*start_routine)(void*), void* arg ) {
+    _stack = pool.acquire();
+    if ( !_stack ) return;
+    _pool = &pool;
+
+    ::pthread_attr_t attr;
+    int retval = ::pthread_attr_init( &attr );
+    ASSERT_EQ0( retval );
+    if ( attrhandle ) detail::copy_thread_attrs( *attrhandle, attr );
+    ::pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_JOINABLE );
+    retval = ::pthread_attr_setstack( &attr, _stack->base, _stack->size );
+    ASSERT_EQ0( retval );
+    _thread = thread( attr, start_routine, arg );
+    ::pthread_attr_destroy( &attr );
+}
+
+inline void pooled_thread::join( void** retval ) {
+    if ( !_thread.joinable() ) return;
+    _thread.join( retval );
+    _hwm = _pool->release( _stack );
+    _stack = nullptr;
+}
+
+
+// Stack measurement for threads on ordinary pthread stacks. The new thread 
+// looks up its own stack and either paints everything below its first frame 
+// (exact to the word, but touches the whole stack, so it is a measurement 
+// mode and not for production RSS) or, at exit, asks mincore() for the lowest 
+// resident stack page (page granular and free, but overestimates on stacks 
+// glibc recycled from earlier threads). The result is known after join.
+
+class measured_thread {
+public:
+    enum method { paint, resident };
+
+    measured_thread( const ::pthread_attr_t& attrhandle, void* (*start_routine)(void*), void* arg = nullptr, 
+                     method m = paint ) 
+        : _probe( new probe{ start_routine, arg, m } ), _thread( attrhandle, run, _probe.get() ) { }
+
+    measured_thread( void* (*start_routine)(void*), void* arg = nullptr, method m = paint ) 
+        : _probe( new probe{ start_routine, arg, m } ), _thread( run, _probe.get() ) { }
+
+    measured_thread() noexcept = default;
+
+    bool joinable() const noexcept { return _thread.joinable(); }
+    ::pthread_t native_handle() noexcept { return _thread.native_handle(); }
+    void join( void** retval = nullptr ) { _thread.join( retval ); }
+
+    // Valid after join
+    std::size_t stack_high_water() const noexcept { return _probe ? _probe->hwm : 0; }
+    std::size_t stack_size() const noexcept { return _probe ? _probe->size : 0; }
+
+private:
+
+    struct probe {
+        void* (*start_routine)(void*);
+        void* arg;
+        method how;
+        std::size_t hwm = 0;
+        std::size_t size = 0;
+        char* bottom = nullptr;
+    };
+
+    static void* run( void* p );
+    static void measure( probe& pr ) noexcept;
+
+    std::unique_ptr<probe> _probe;   // declared first, the thread uses it
+    thread _thread;
+};
+
+[[gnu::noinline]] inline void measured_thread::measure( probe& pr ) noexcept {
+    if ( !pr.bottom ) return;
+    if ( pr.how == paint ) {
+        pr.hwm = detail::painted_usage( pr.bottom, pr.size );
+        return;
+    }
+    const std::size_t page = detail::page_size();
+    std::vector<unsigned char> pages( pr.size / page );
+    if ( ::mincore( pr.bottom, pages.size() * page, pages.data() ) != 0 ) return;
+    std::size_t i = 0;
+    while ( i < pages.size() && !( pages[i] & 1 ) ) i++;
+    pr.hwm = pr.size - i * page;
+}
+
+[[gnu::noinline]] inline void* measured_thread::run( void* p ) {
+    probe& pr = *static_cast<probe*>(p);
+
+    ::pthread_attr_t attr;
+    void* addr = nullptr;
+    if ( ::pthread_getattr_np( ::pthread_self(), &attr ) == 0 ) {
+        ::pthread_attr_getstack( &attr, &addr, &pr.size );
+        ::pthread_attr_destroy( &attr );
+        pr.bottom = static_cast<char*>(addr);
+    }
+
+    if ( pr.bottom && pr.how == paint ) {
+        // Leave room below this frame for the painting itself
+        constexpr std::size_t margin = 4096;
+        char here;
+        char* limit = &here - margin;
+        if ( limit > pr.bottom ) detail::paint( pr.bottom, std::size_t( limit - pr.bottom ) & ~std::size_t(7) );
+    }
+
+    struct on_exit {
+        probe& pr;
+        ~on_exit() { measure( pr ); }
+    } measure_at_exit{ pr };
+    return pr.start_routine( pr.arg );
+}
+
+
+// Collects stack high-water marks per thread role and suggests stack sizes: 
+// the largest mark seen times headroom, page rounded and at least 
+// PTHREAD_STACK_MIN. Thread safe.
+
+class stack_advisor {
+public:
+    explicit stack_advisor( double headroom = 1.5 ) : _headroom( headroom ) { }
+
+    stack_advisor( const stack_advisor& other ) = delete;
+    stack_advisor& operator=( const stack_advisor& other ) = delete;
+
+    void record( const std::string& role, std::size_t high_water );
+    void record( const std::string& role, const measured_thread& t ) { record( role, t.stack_high_water() ); }
+
+    // 0 while nothing was recorded for role
+    std::size_t suggest( const std::string& role );
+
+    // Sets the suggested size on attr, returns it (0 leaves attr untouched)
+    std::size_t apply( const std::string& role, ::pthread_attr_t& attrhandle );
+
+    // role, samples, max, mean and suggested size, one line per role
+    void report( std::FILE* out = stdout );
+
+private:
+
+    struct usage {
+        std::string role;
+        std::size_t samples = 0;
+        std::size_t max = 0;
+        std::size_t total = 0;
+    };
+
+    usage* find( const std::string& role ) noexcept;
+    std::size_t size_for( const usage& u ) const noexcept;
+
+    double _headroom;
+    hybrid_mutex _lock;     // guards _roles
+    std::vector<usage> _roles;
+};
+
+inline stack_advisor::usage* stack_advisor::find( const std::string& role ) noexcept {
+    for ( auto& u : _roles ) {
+        if ( u.role == role ) return &u;
+    }
+    return nullptr;
+}
+
+inline std::size_t stack_advisor::size_for( const usage& u ) const noexcept {
+    if ( !u.samples ) return 0;
+    std::size_t size = detail::round_up( std::size_t( double(u.max) * _headroom ), detail::page_size() );
+    return size < std::size_t(PTHREAD_STACK_MIN) ? std::size_t(PTHREAD_STACK_MIN) : size;
+}
+
+inline void stack_advisor::record( const std::string& role, std::size_t high_water ) {
+    _lock.lock();
+    usage* u = find( role );
+    if ( !u ) u = &_roles.emplace_back( usage{ role } );
+    u->samples++;
+    u->total += high_water;
+    if ( high_water > u->max ) u->max = high_water;
+    _lock.unlock();
+}
+
+inline std::size_t stack_advisor::suggest( const std::string& role ) {
+    _lock.lock();
+    usage* u = find( role );
+    std::size_t size = u ? size_for( *u ) : 0;
+    _lock.unlock();
+    return size;
+}
+
+inline std::size_t stack_advisor::apply( const std::string& role, ::pthread_attr_t& attrhandle ) {
+    std::size_t size = suggest( role );
+    if ( size ) {
+        int retval = ::pthread_attr_setstacksize( &attrhandle, size );
+        ASSERT_EQ0( retval );
+    }
+    return size;
+}
+
+inline void stack_advisor::report( std::FILE* out ) {
+    _lock.lock();
+    std::fprintf( out, "%-20s %10s %12s %12s %12s\n", "role", "samples", "max", "mean", "suggested" );
+    for ( auto& u : _roles ) {
+        std::fprintf( out, "%-20s %10zu %12zu %12zu %12zu\n", u.role.c_str(), u.samples, u.max, 
+                      u.samples ? u.total / u.samples : 0, size_for( u ) );
+    }
+    _lock.unlock();
+}
+
+} // namespace pth
+
+#endif // PTH_STACK_HXX